@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "bgb.h"
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Frontend for the BGB link protocol (version 1.4)
+//
+// Emulators supporting the BGB link protocol connect to each other through
+//   TCP, exchanging 8-byte packets:
+// - u8 command
+// - u8 b2, b3, b4: parameters
+// - u32le i1: timestamp, in 2MiHz clock cycles (31 bits)
+//
+// The emulator is the master of the serial link, and sends a SYNC1 packet for
+//   every byte exchange, along with frequent SYNC3 packets to keep the clocks
+//   in sync. Every received packet is processed in order, but the replies are
+//   written out together once all of the data read from the socket has been
+//   processed, and only one reply is sent for all of the SYNC3 packets
+//   received at once.
+//
+// The emulator's timestamps drive the library's timebase, so that the
+//   adapter's timeouts follow the emulated time, including pauses and fast
+//   forward.
+
+#define BGB_CLOCK_RATE 2097152
+
+enum bgb_command {
+    BGB_VERSION = 1,
+    BGB_JOYPAD = 101,
+    BGB_SYNC1 = 104,
+    BGB_SYNC2 = 105,
+    BGB_SYNC3 = 106,
+    BGB_STATUS = 108,
+    BGB_WANTDISCONNECT = 109
+};
+
+#define BGB_STATUS_RUNNING 1
+#define BGB_STATUS_SUPPORTRECONNECT 4
+
+void mobile_bgb_init(struct mobile_bgb *bgb, struct mobile_adapter *adapter, mobile_func_bgb_write func, void *user)
+{
+    bgb->adapter = adapter;
+    bgb->user = user;
+    bgb->write = func;
+    bgb->handshake = false;
+    bgb->sync_pending = false;
+    bgb->time_valid = false;
+    bgb->time_last = 0;
+    bgb->packet_size = 0;
+    bgb->send_size = 0;
+
+    mobile_time_set_rate(adapter, BGB_CLOCK_RATE);
+}
+
+static void bgb_flush(struct mobile_bgb *bgb)
+{
+    if (!bgb->send_size) return;
+    bgb->write(bgb->user, bgb->send, bgb->send_size);
+    bgb->send_size = 0;
+}
+
+static void bgb_send(struct mobile_bgb *bgb, unsigned char cmd, unsigned char b2, unsigned char b3, unsigned char b4)
+{
+    if (bgb->send_size + MOBILE_BGB_PACKET_SIZE > sizeof(bgb->send)) {
+        bgb_flush(bgb);
+    }
+
+    unsigned char *p = bgb->send + bgb->send_size;
+    p[0] = cmd;
+    p[1] = b2;
+    p[2] = b3;
+    p[3] = b4;
+    p[4] = bgb->time_last >> 0;
+    p[5] = bgb->time_last >> 8;
+    p[6] = bgb->time_last >> 16;
+    p[7] = bgb->time_last >> 24;
+    bgb->send_size += MOBILE_BGB_PACKET_SIZE;
+}
+
+void mobile_bgb_connected(struct mobile_bgb *bgb)
+{
+    bgb->handshake = false;
+    bgb->sync_pending = false;
+    bgb->time_valid = false;
+    bgb->packet_size = 0;
+    bgb->send_size = 0;
+
+    bgb_send(bgb, BGB_VERSION, 1, 4, 0);
+    bgb_send(bgb, BGB_STATUS, BGB_STATUS_RUNNING | BGB_STATUS_SUPPORTRECONNECT,
+        0, 0);
+    bgb_flush(bgb);
+}
+
+// Returns the emulated clock cycles passed since the previous packet
+static uint32_t bgb_timestamp(struct mobile_bgb *bgb, const unsigned char *p)
+{
+    uint32_t timestamp =
+        ((uint32_t)p[4] << 0 |
+         (uint32_t)p[5] << 8 |
+         (uint32_t)p[6] << 16 |
+         (uint32_t)p[7] << 24) & 0x7FFFFFFF;
+
+    uint32_t cycles = 0;
+    if (bgb->time_valid) cycles = (timestamp - bgb->time_last) & 0x7FFFFFFF;
+    bgb->time_last = timestamp;
+    bgb->time_valid = true;
+    return cycles;
+}
+
+// Returns: false if the connection should be closed
+static bool bgb_packet(struct mobile_bgb *bgb, const unsigned char *p)
+{
+    struct mobile_adapter *adapter = bgb->adapter;
+
+    if (!bgb->handshake) {
+        if (p[0] != BGB_VERSION || p[1] != 1 || p[2] != 4 || p[3] != 0) {
+            return false;
+        }
+        bgb->handshake = true;
+        return true;
+    }
+
+    switch (p[0]) {
+    case BGB_SYNC1: {
+        uint32_t cycles = bgb_timestamp(bgb, p);
+        unsigned char c = mobile_transfer_cycles(adapter, p[1], cycles);
+        bgb_send(bgb, BGB_SYNC2, c, 0x80, 0);
+        break;
+    }
+
+    case BGB_SYNC3:
+        // Without a transfer, the time passes all the same
+        mobile_time_advance_serial(adapter, bgb_timestamp(bgb, p));
+        if (p[1] == 0) bgb->sync_pending = true;
+        break;
+
+    case BGB_VERSION:
+        return false;
+
+    case BGB_WANTDISCONNECT:
+        return false;
+
+    default:
+        // Joypad and status updates, and anything unknown
+        break;
+    }
+    return true;
+}
+
+bool mobile_bgb_recv(struct mobile_bgb *bgb, const void *data, unsigned size)
+{
+    const unsigned char *buf = data;
+    bool ok = true;
+
+    for (unsigned i = 0; i < size && ok; i++) {
+        bgb->packet[bgb->packet_size++] = buf[i];
+        if (bgb->packet_size < MOBILE_BGB_PACKET_SIZE) continue;
+        bgb->packet_size = 0;
+
+        ok = bgb_packet(bgb, bgb->packet);
+    }
+
+    if (bgb->sync_pending) {
+        bgb_send(bgb, BGB_SYNC3, 0, 0, 0);
+        bgb->sync_pending = false;
+    }
+    bgb_flush(bgb);
+    return ok;
+}
+
+const size_t mobile_bgb_sizeof PROGMEM = sizeof(struct mobile_bgb);
+
+#ifndef MOBILE_ENABLE_NOALLOC
+#include <stdlib.h>
+struct mobile_bgb *mobile_bgb_new(struct mobile_adapter *adapter, mobile_func_bgb_write func, void *user)
+{
+    struct mobile_bgb *bgb = malloc(sizeof(struct mobile_bgb));
+    mobile_bgb_init(bgb, adapter, func, user);
+    return bgb;
+}
+#endif
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mobile.h"
+
+#define MOBILE_BGB_PACKET_SIZE 8
+#define MOBILE_BGB_MAX_PACKETS 32
+
+struct mobile_bgb {
+    struct mobile_adapter *adapter;
+    void *user;
+    mobile_func_bgb_write write;
+
+    bool handshake : 1;
+
+    // A timestamp sync has been requested, and will be replied to once
+    bool sync_pending : 1;
+
+    // Emulator timestamp of the last packet
+    bool time_valid : 1;
+    uint32_t time_last;
+
+    // Packet being received
+    unsigned char packet[MOBILE_BGB_PACKET_SIZE];
+    unsigned char packet_size;
+
+    // Replies, written out at once
+    unsigned send_size;
+    unsigned char send[MOBILE_BGB_PACKET_SIZE * MOBILE_BGB_MAX_PACKETS];
+};
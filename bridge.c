@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "bridge.h"
+
+#include <string.h>
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Driver for hardware bridges
+//
+// A hardware bridge is a small microcontroller which is wired to the serial
+//   port of the console, and connected to the host through a UART (or any other
+//   byte stream). As the round trip through the UART is too slow to answer
+//   every byte exchange in time, the bridge clocks out the data it was given in
+//   advance on its own, and reports the data it received in batches.
+//
+// Protocol description
+//
+// Every message is sent as a frame, in both directions:
+// - u8 sync: always 0x5A
+// - u8 type
+// - u8 length: size of the payload
+// - u8 payload[length]
+// - u8 checksum: 8-bit sum of the type, length and payload bytes
+// A receiver drops any frame with a bad checksum, and looks for the next sync
+//   byte.
+//
+// Frames sent by the bridge:
+// - RECV (0x01): Data received from the console
+//   - u32le timestamp: time of the first exchange, in microseconds
+//   - u8 consumed: amount of exchanges during which run data was sent
+//   - u8 data[]: received data, in order
+//   The first <consumed> exchanges of a batch clock out run data, the rest
+//     clock out idle bytes (0xD2), as the run is exhausted, or acknowledge a
+//     packet (see below). The bridge must flush the batch before it starts
+//     clocking out a new run, and at least once every millisecond while the
+//     console is clocking the link.
+//
+// Frames sent by the host:
+// - RUN (0x81): Data to clock out next
+//   - u8 data[]: appended to the queue of data to clock out
+//   A run is only ever sent when the previous one has been fully clocked out.
+// - MODE (0x82): Change the serial mode
+//   - u8 mode: 0 for 8bit, 1 for 32bit
+//   Clears the queue of data to clock out.
+// - ACK (0x83): How to acknowledge packets
+//   - u8 device: device byte of the adapter
+//   - u8 commands[16]: the commands the adapter supports, one bit for every
+//     command from 0x00 to 0x7F, least significant bit first
+//   Sent before the first run, and whenever the device byte changes.
+//
+// The host only sends data that libmobile will send regardless of what the
+//   console sends, as given by mobile_transfer_predict(). A run begins with
+//   the first exchange libmobile doesn't want an idle byte for, and any
+//   exchange the bridge clocks out an idle byte for instead is held back, so
+//   that libmobile's serial state always matches what the console received.
+//
+// The acknowledgement of a packet is due right after its checksum, which
+//   leaves no time for a round trip. Instead, the bridge follows the packets
+//   sent by the console (see framing.h), and clocks out the acknowledgement
+//   in place of idle bytes:
+// - In 8bit mode, the device byte, followed by the command with bit 7 set.
+//   The latter is replaced by 0xF1 if the checksum doesn't match the sum of
+//   the header and data, or else by 0xF0 if the command isn't supported.
+//   Unless the device byte is 0x88, it's replaced by an idle byte if the
+//   console's device byte isn't 0x81 or 0x82.
+// - In 32bit mode, a word made of the device byte, the acknowledgement as in
+//   8bit mode, and two zero bytes.
+
+#define BRIDGE_SYNC 0x5A
+#define BRIDGE_ACK_COMMANDS 0x80
+
+enum bridge_type {
+    BRIDGE_RECV = 0x01,
+    BRIDGE_RUN = 0x81,
+    BRIDGE_MODE = 0x82,
+    BRIDGE_ACK = 0x83
+};
+
+void mobile_bridge_init(struct mobile_bridge *bridge, struct mobile_adapter *adapter, mobile_func_bridge_write func, void *user)
+{
+    bridge->adapter = adapter;
+    bridge->user = user;
+    bridge->write = func;
+    bridge->state = MOBILE_BRIDGE_FRAME_SYNC;
+    bridge->mode_32bit = false;
+    bridge->time_valid = false;
+    bridge->time_last = 0;
+    bridge->next = MOBILE_SERIAL_IDLE_BYTE;
+    bridge->pending = 0;
+    bridge->device = 0;
+    bridge->acking = 0;
+    bridge->word_size = 0;
+    bridge->word_run = false;
+    bridge->word_local = false;
+    memset(&bridge->stats, 0, sizeof(bridge->stats));
+}
+
+static void bridge_write(struct mobile_bridge *bridge, enum bridge_type type, const unsigned char *data, unsigned size)
+{
+    unsigned char frame[3 + MOBILE_BRIDGE_MAX_PAYLOAD + 1];
+
+    frame[0] = BRIDGE_SYNC;
+    frame[1] = type;
+    frame[2] = size;
+    memcpy(frame + 3, data, size);
+
+    unsigned char checksum = 0;
+    for (unsigned i = 1; i < 3 + size; i++) checksum += frame[i];
+    frame[3 + size] = checksum;
+
+    bridge->write(bridge->user, frame, 3 + size + 1);
+}
+
+// Configure the bridge with the serial mode libmobile is currently using
+static void bridge_mode(struct mobile_bridge *bridge)
+{
+    bool mode_32bit = bridge->adapter->serial.mode_32bit;
+    if (bridge->mode_32bit == mode_32bit) return;
+
+    unsigned char mode = mode_32bit;
+    bridge_write(bridge, BRIDGE_MODE, &mode, 1);
+
+    bridge->mode_32bit = mode_32bit;
+    bridge->next = mode_32bit ? MOBILE_SERIAL_IDLE_WORD : MOBILE_SERIAL_IDLE_BYTE;
+    bridge->pending = 0;
+    bridge->acking = 0;
+    bridge->word_size = 0;
+}
+
+// Configure the bridge with the way libmobile acknowledges packets
+static void bridge_ack(struct mobile_bridge *bridge)
+{
+    unsigned char ack[1 + BRIDGE_ACK_COMMANDS / 8];
+
+    unsigned char device = mobile_serial_device(bridge->adapter);
+    if (bridge->device == device) return;
+
+    ack[0] = device;
+    memset(ack + 1, 0, sizeof(ack) - 1);
+    for (unsigned i = 0; i < BRIDGE_ACK_COMMANDS; i++) {
+        if (!mobile_commands_exists(i)) continue;
+        ack[1 + i / 8] |= 1 << (i % 8);
+    }
+    bridge_write(bridge, BRIDGE_ACK, ack, sizeof(ack));
+
+    bridge->device = device;
+}
+
+// Send the data libmobile will send next, if the bridge can't idle through it
+static void bridge_run(struct mobile_bridge *bridge)
+{
+    unsigned char run[MOBILE_BRIDGE_MAX_PAYLOAD];
+
+    if (bridge->pending || bridge->acking) return;
+
+    unsigned size;
+    if (bridge->mode_32bit) {
+        if (bridge->next == MOBILE_SERIAL_IDLE_WORD) return;
+        run[0] = bridge->next >> 24;
+        run[1] = bridge->next >> 16;
+        run[2] = bridge->next >> 8;
+        run[3] = bridge->next >> 0;
+        size = 4;
+    } else {
+        if (bridge->next == MOBILE_SERIAL_IDLE_BYTE) return;
+        run[0] = bridge->next;
+        size = 1;
+    }
+    size += mobile_transfer_predict(bridge->adapter, run + size,
+        sizeof(run) - size);
+
+    // Idle bytes are sent by the bridge anyway
+    unsigned char unit = bridge->mode_32bit ? 4 : 1;
+    while (size > unit) {
+        unsigned i;
+        for (i = size - unit; i < size; i++) {
+            if (run[i] != MOBILE_SERIAL_IDLE_BYTE) break;
+        }
+        if (i != size) break;
+        size -= unit;
+    }
+
+    bridge_write(bridge, BRIDGE_RUN, run, size);
+    bridge->pending = size;
+    bridge->stats.runs++;
+}
+
+// Pass a single exchange to libmobile
+static void bridge_exchange(struct mobile_bridge *bridge, unsigned char c, bool run, uint32_t cycles)
+{
+    struct mobile_adapter *adapter = bridge->adapter;
+
+    bridge->stats.exchanges++;
+    if (run) bridge->pending--;
+
+    // The bridge sent the acknowledgement of a packet on its own
+    bool local = bridge->acking;
+    if (local) bridge->acking--;
+
+    if (!bridge->mode_32bit) {
+        // Hold back libmobile if the bridge didn't send what it wanted to
+        if (!run && !local && bridge->next != MOBILE_SERIAL_IDLE_BYTE) {
+            bridge->stats.slips++;
+            mobile_time_advance_serial(adapter, cycles);
+            return;
+        }
+        bridge->next = mobile_transfer_cycles(adapter, c, cycles);
+
+        // The device byte and acknowledgement follow the checksum
+        if (adapter->serial.state == MOBILE_SERIAL_ACKNOWLEDGE) {
+            bridge->acking = 2;
+        }
+        return;
+    }
+
+    if (!bridge->word_size) {
+        bridge->word_run = run;
+        bridge->word_local = local;
+    }
+    bridge->word[bridge->word_size++] = c;
+    mobile_time_advance_serial(adapter, cycles);
+    if (bridge->word_size < 4) return;
+    bridge->word_size = 0;
+
+    if (!bridge->word_run && !bridge->word_local &&
+            bridge->next != MOBILE_SERIAL_IDLE_WORD) {
+        bridge->stats.slips++;
+        return;
+    }
+    enum mobile_serial_state state = adapter->serial.state;
+    bridge->next = mobile_transfer_32bit(adapter,
+        (uint32_t)bridge->word[0] << 24 |
+        (uint32_t)bridge->word[1] << 16 |
+        (uint32_t)bridge->word[2] << 8 |
+        (uint32_t)bridge->word[3] << 0);
+
+    // The word following the checksum is the acknowledgement
+    if (state != MOBILE_SERIAL_IDLE_CHECK &&
+            adapter->serial.state == MOBILE_SERIAL_IDLE_CHECK) {
+        bridge->acking = 4;
+    }
+}
+
+static void bridge_recv_batch(struct mobile_bridge *bridge)
+{
+    if (bridge->length < 5) {
+        bridge->stats.frames_invalid++;
+        return;
+    }
+
+    uint32_t timestamp =
+        (uint32_t)bridge->payload[0] << 0 |
+        (uint32_t)bridge->payload[1] << 8 |
+        (uint32_t)bridge->payload[2] << 16 |
+        (uint32_t)bridge->payload[3] << 24;
+    unsigned consumed = bridge->payload[4];
+    const unsigned char *data = bridge->payload + 5;
+    unsigned size = bridge->length - 5;
+
+    if (consumed > size || consumed > bridge->pending) {
+        bridge->stats.frames_invalid++;
+        consumed = size < bridge->pending ? size : bridge->pending;
+    }
+
+    // The time between batches drives the timebase, if one is configured
+    uint32_t cycles = 0;
+    if (bridge->time_valid) cycles = timestamp - bridge->time_last;
+    bridge->time_last = timestamp;
+    bridge->time_valid = true;
+
+    for (unsigned i = 0; i < size; i++) {
+        bridge_exchange(bridge, data[i], i < consumed, i ? 0 : cycles);
+    }
+}
+
+static void bridge_frame(struct mobile_bridge *bridge)
+{
+    switch (bridge->type) {
+    case BRIDGE_RECV:
+        bridge_recv_batch(bridge);
+        break;
+    default:
+        bridge->stats.frames_invalid++;
+        break;
+    }
+}
+
+void mobile_bridge_recv(struct mobile_bridge *bridge, const void *data, unsigned size)
+{
+    const unsigned char *buf = data;
+
+    bridge_mode(bridge);
+    bridge_ack(bridge);
+
+    for (unsigned i = 0; i < size; i++) {
+        unsigned char c = buf[i];
+
+        switch (bridge->state) {
+        case MOBILE_BRIDGE_FRAME_SYNC:
+            if (c == BRIDGE_SYNC) bridge->state = MOBILE_BRIDGE_FRAME_TYPE;
+            break;
+
+        case MOBILE_BRIDGE_FRAME_TYPE:
+            bridge->type = c;
+            bridge->checksum = c;
+            bridge->state = MOBILE_BRIDGE_FRAME_LENGTH;
+            break;
+
+        case MOBILE_BRIDGE_FRAME_LENGTH:
+            bridge->length = c;
+            bridge->checksum += c;
+            bridge->current = 0;
+            if (bridge->length) {
+                bridge->state = MOBILE_BRIDGE_FRAME_PAYLOAD;
+            } else {
+                bridge->state = MOBILE_BRIDGE_FRAME_CHECKSUM;
+            }
+            break;
+
+        case MOBILE_BRIDGE_FRAME_PAYLOAD:
+            bridge->payload[bridge->current++] = c;
+            bridge->checksum += c;
+            if (bridge->current >= bridge->length) {
+                bridge->state = MOBILE_BRIDGE_FRAME_CHECKSUM;
+            }
+            break;
+
+        case MOBILE_BRIDGE_FRAME_CHECKSUM:
+            bridge->state = MOBILE_BRIDGE_FRAME_SYNC;
+            if (c != bridge->checksum) {
+                bridge->stats.frames_invalid++;
+                break;
+            }
+            bridge_frame(bridge);
+            break;
+        }
+    }
+
+    bridge_run(bridge);
+}
+
+void mobile_bridge_poll(struct mobile_bridge *bridge)
+{
+    bridge_mode(bridge);
+    bridge_ack(bridge);
+    bridge_run(bridge);
+}
+
+void mobile_bridge_get_stats(struct mobile_bridge *bridge, struct mobile_bridge_stats *stats)
+{
+    *stats = bridge->stats;
+}
+
+const size_t mobile_bridge_sizeof PROGMEM = sizeof(struct mobile_bridge);
+
+#ifndef MOBILE_ENABLE_NOALLOC
+#include <stdlib.h>
+struct mobile_bridge *mobile_bridge_new(struct mobile_adapter *adapter, mobile_func_bridge_write func, void *user)
+{
+    struct mobile_bridge *bridge = malloc(sizeof(struct mobile_bridge));
+    mobile_bridge_init(bridge, adapter, func, user);
+    return bridge;
+}
+#endif
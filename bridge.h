@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mobile.h"
+
+#define MOBILE_BRIDGE_MAX_PAYLOAD 0xFF
+
+enum mobile_bridge_frame_state {
+    MOBILE_BRIDGE_FRAME_SYNC,
+    MOBILE_BRIDGE_FRAME_TYPE,
+    MOBILE_BRIDGE_FRAME_LENGTH,
+    MOBILE_BRIDGE_FRAME_PAYLOAD,
+    MOBILE_BRIDGE_FRAME_CHECKSUM
+};
+
+struct mobile_bridge {
+    struct mobile_adapter *adapter;
+    void *user;
+    mobile_func_bridge_write write;
+
+    // Frame being received from the bridge
+    enum mobile_bridge_frame_state state;
+    unsigned char type;
+    unsigned char length;
+    unsigned char current;
+    unsigned char checksum;
+    unsigned char payload[MOBILE_BRIDGE_MAX_PAYLOAD];
+
+    // Serial mode the bridge has been configured with
+    bool mode_32bit : 1;
+
+    // Timestamp of the last batch, for the timebase
+    bool time_valid : 1;
+    uint32_t time_last;
+
+    // Data libmobile wants to send in the next exchange
+    uint32_t next;
+
+    // Bytes sent through a run, which the bridge hasn't clocked out yet
+    unsigned pending;
+
+    // Device byte the bridge acknowledges packets with, and the amount of
+    //   exchanges left in the acknowledgement it's sending
+    unsigned char device;
+    unsigned char acking;
+
+    // Bytes received during a partial exchange in 32bit mode
+    unsigned char word[4];
+    unsigned char word_size;
+    bool word_run;
+    bool word_local;
+
+    struct mobile_bridge_stats stats;
+};
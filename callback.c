@@ -100,6 +100,25 @@ IMPL void mobile_impl_update_number(A_UNUSED void *user, A_UNUSED enum mobile_nu
 {
     return;
 }
+
+IMPL int mobile_impl_sock_connect_data(A_UNUSED void *user, A_UNUSED unsigned conn, A_UNUSED const struct mobile_addr *addr, A_UNUSED const void *data, A_UNUSED unsigned size)
+{
+    return -2;
+}
+
+#ifdef MOBILE_ENABLE_PROFILER
+IMPL uint32_t mobile_impl_profile_clock(A_UNUSED void *user)
+{
+    return 0;
+}
+#endif
+
+#ifdef MOBILE_ENABLE_SUMMARY
+IMPL void mobile_impl_session_summary(A_UNUSED void *user, A_UNUSED const struct mobile_session_summary *summary)
+{
+    return;
+}
+#endif
 #endif
 
 void mobile_callback_init(struct mobile_adapter *adapter)
@@ -121,6 +140,13 @@ void mobile_callback_init(struct mobile_adapter *adapter)
     adapter->callback.sock_send = mobile_impl_sock_send;
     adapter->callback.sock_recv = mobile_impl_sock_recv;
     adapter->callback.update_number = mobile_impl_update_number;
+    adapter->callback.sock_connect_data = mobile_impl_sock_connect_data;
+#ifdef MOBILE_ENABLE_PROFILER
+    adapter->callback.profile_clock = mobile_impl_profile_clock;
+#endif
+#ifdef MOBILE_ENABLE_SUMMARY
+    adapter->callback.session_summary = mobile_impl_session_summary;
+#endif
 #endif
 }
 
@@ -146,4 +172,11 @@ def(sock_accept)
 def(sock_send)
 def(sock_recv)
 def(update_number)
+def(sock_connect_data)
+#ifdef MOBILE_ENABLE_PROFILER
+def(profile_clock)
+#endif
+#ifdef MOBILE_ENABLE_SUMMARY
+def(session_summary)
+#endif
 #endif
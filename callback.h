@@ -10,8 +10,9 @@
 enum mobile_timers {
     MOBILE_TIMER_SERIAL,
     MOBILE_TIMER_COMMAND,
-    MOBILE_TIMER_RESERVED3,
-    MOBILE_TIMER_RESERVED4,
+    MOBILE_TIMER_NUMBER_FETCH,
+    MOBILE_TIMER_PARKED,
+    MOBILE_TIMER_CLOCK,
     _MOBILE_MAX_TIMERS
 };
 
@@ -32,6 +33,13 @@ struct mobile_adapter_callback {
     mobile_func_sock_send sock_send;
     mobile_func_sock_recv sock_recv;
     mobile_func_update_number update_number;
+    mobile_func_sock_connect_data sock_connect_data;
+#ifdef MOBILE_ENABLE_PROFILER
+    mobile_func_profile_clock profile_clock;
+#endif
+#ifdef MOBILE_ENABLE_SUMMARY
+    mobile_func_session_summary session_summary;
+#endif
 #endif
 };
 void mobile_callback_init(struct mobile_adapter *adapter);
@@ -46,7 +54,13 @@ void mobile_callback_init(struct mobile_adapter *adapter);
 
 // Help MSVC expand __VA_ARGS__
 #define _mobile_cb_e(x) x
+#ifdef MOBILE_ENABLE_PROFILER
+// Measure every call, see profile.c
+#include "profile.h"
+#define _mobile_cb(name, ...) _mobile_cb_e(mobile_profile_cb_ ## name(__VA_ARGS__))
+#else
 #define _mobile_cb(name, ...) _mobile_cb_e(mobile_cb(name, __VA_ARGS__))
+#endif
 
 #define mobile_cb_debug_log(...) _mobile_cb(debug_log, __VA_ARGS__)
 #define mobile_cb_serial_disable(...) _mobile_cb(serial_disable, __VA_ARGS__)
@@ -63,3 +77,7 @@ void mobile_callback_init(struct mobile_adapter *adapter);
 #define mobile_cb_sock_send(...) _mobile_cb(sock_send, __VA_ARGS__)
 #define mobile_cb_sock_recv(...) _mobile_cb(sock_recv, __VA_ARGS__)
 #define mobile_cb_update_number(...) _mobile_cb(update_number, __VA_ARGS__)
+#define mobile_cb_sock_connect_data(...) _mobile_cb(sock_connect_data, __VA_ARGS__)
+#ifdef MOBILE_ENABLE_SUMMARY
+#define mobile_cb_session_summary(...) _mobile_cb(session_summary, __VA_ARGS__)
+#endif
@@ -54,6 +54,7 @@ void mobile_commands_init(struct mobile_adapter *adapter)
 {
     adapter->commands.session_started = false;
     adapter->commands.mode_32bit = false;
+    adapter->commands.parked = false;
 }
 
 static struct mobile_packet *error_packet(struct mobile_packet *packet, unsigned char error)
@@ -66,16 +67,188 @@ static struct mobile_packet *error_packet(struct mobile_packet *packet, unsigned
     return packet;
 }
 
+// The timing of the data exchanged over every connection is tracked, to
+//   estimate the quality of the network, see mobile_connection_get_stats().
+
+// Time over which the throughput is measured
+#define TIMING_WINDOW_MS 1000
+
+// Lower bound of the adaptive receive wait, see command_data()
+#define RECV_WAIT_MIN_MS 200
+
+static void connection_opened(struct mobile_adapter *adapter, unsigned char conn)
+{
+    struct mobile_adapter_commands *s = &adapter->commands;
+    struct mobile_connection_timing *t =
+        &adapter->buffer->connections.timing[conn];
+
+    uint32_t now = mobile_time_now(adapter);
+    t->last_activity = now;
+    t->send_time = 0;
+    t->awaiting = false;
+    t->measured = false;
+    t->srtt = 0;
+    t->rttvar = 0;
+    t->window_start = now;
+    t->window_bytes = 0;
+    t->throughput = 0;
+    t->bytes_sent = 0;
+    t->bytes_recv = 0;
+
+    s->connections[conn] = true;
+}
+
+static void connection_timing_update(struct mobile_adapter *adapter, unsigned char conn, unsigned sent, unsigned recv)
+{
+    struct mobile_connection_timing *t =
+        &adapter->buffer->connections.timing[conn];
+
+    if (!sent && !recv) return;
+    uint32_t now = mobile_time_now(adapter);
+    t->last_activity = now;
+    t->bytes_sent += sent;
+    t->bytes_recv += recv;
+
+    // Every reply to a send is a round trip, estimated like TCP does
+    if (recv && t->awaiting) {
+        uint32_t rtt = now - t->send_time;
+        if (!t->measured) {
+            t->srtt = rtt * 8;
+            t->rttvar = rtt * 2;
+            t->measured = true;
+        } else {
+            uint32_t srtt = t->srtt / 8;
+            uint32_t delta = rtt > srtt ? rtt - srtt : srtt - rtt;
+            t->rttvar += delta - t->rttvar / 4;
+            t->srtt += rtt - srtt;
+        }
+        t->awaiting = false;
+    }
+    if (sent && !t->awaiting) {
+        t->send_time = now;
+        t->awaiting = true;
+    }
+
+    t->window_bytes += sent + recv;
+    if (now - t->window_start >= TIMING_WINDOW_MS) {
+        t->throughput = t->window_bytes * 1000 / (now - t->window_start);
+        t->window_start = now;
+        t->window_bytes = 0;
+    }
+}
+
+// Time to wait for incoming data when the game sends nothing
+// Once the round trip time is known, there's little use in waiting much
+//   longer than a reply would take to arrive.
+static unsigned connection_recv_wait(struct mobile_adapter *adapter, unsigned char conn)
+{
+    struct mobile_connection_timing *t =
+        &adapter->buffer->connections.timing[conn];
+
+    unsigned timeout = adapter->time.timeouts[MOBILE_TIMEOUT_RECV];
+    if (!t->measured) return timeout;
+
+    uint32_t wait = t->srtt / 8 + t->rttvar;
+    if (wait < RECV_WAIT_MIN_MS) wait = RECV_WAIT_MIN_MS;
+    if (wait > timeout) return timeout;
+    return (unsigned)wait;
+}
+
+bool mobile_connection_get_stats(struct mobile_adapter *adapter, unsigned conn, struct mobile_connection_stats *stats)
+{
+    struct mobile_adapter_commands *s = &adapter->commands;
+
+    if (conn >= MOBILE_MAX_TCP_CONNECTIONS || !s->connections[conn]) {
+        return false;
+    }
+    const struct mobile_connection_timing *t =
+        &adapter->buffer->connections.timing[conn];
+
+    uint32_t now = mobile_time_now(adapter);
+    stats->rtt_ms = t->srtt / 8;
+    stats->rtt_var_ms = t->rttvar / 4;
+    stats->throughput = t->throughput;
+    if (now - t->window_start >= TIMING_WINDOW_MS) {
+        // Account for the time spent idle since the last window
+        stats->throughput = t->window_bytes * 1000 / (now - t->window_start);
+    }
+    stats->idle_ms = now - t->last_activity;
+    stats->bytes_sent = t->bytes_sent;
+    stats->bytes_recv = t->bytes_recv;
+    return true;
+}
+
+// Games tend to retry a TCP connection when it times out. Instead of closing
+//   the socket, the attempt is parked for a while, and taken over by the next
+//   attempt to connect to the same address.
+
+static void connection_unpark(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_commands *s = &adapter->commands;
+
+    if (!s->parked) return;
+    mobile_cb_sock_close(adapter, s->parked_conn);
+    s->parked = false;
+}
+
+static void connection_park(struct mobile_adapter *adapter, unsigned char conn, const struct mobile_addr *addr)
+{
+    struct mobile_adapter_commands *s = &adapter->commands;
+
+    connection_unpark(adapter);
+    s->parked = true;
+    s->parked_conn = conn;
+    mobile_addr_copy(&adapter->buffer->connections.parked_addr, addr);
+    mobile_time_latch(adapter, MOBILE_TIMER_PARKED);
+    s->connections[conn] = false;
+}
+
+// Takes over a parked connection attempt to the same address
+// Returns: -1 if there's none, the connection number otherwise
+static int connection_adopt(struct mobile_adapter *adapter, const struct mobile_addr *addr)
+{
+    struct mobile_adapter_commands *s = &adapter->commands;
+
+    if (!s->parked) return -1;
+    if (!mobile_addr_compare(&adapter->buffer->connections.parked_addr,
+            addr)) {
+        return -1;
+    }
+
+    s->parked = false;
+    connection_opened(adapter, s->parked_conn);
+    return s->parked_conn;
+}
+
+bool mobile_commands_parked_expired(struct mobile_adapter *adapter)
+{
+    if (!adapter->commands.parked) return false;
+    return mobile_time_check_timeout(adapter, MOBILE_TIMER_PARKED,
+        MOBILE_TIMEOUT_PARKED);
+}
+
+void mobile_commands_parked_expire(struct mobile_adapter *adapter)
+{
+    if (!mobile_commands_parked_expired(adapter)) return;
+    connection_unpark(adapter);
+}
+
 static int connection_new(struct mobile_adapter *adapter)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
 
-    // Find a free connection slot
+    // Find a free connection slot, leaving any parked connection alone
     unsigned char conn;
-    for (conn = 0; conn < MOBILE_MAX_CONNECTIONS; conn++) {
-        if (!s->connections[conn]) break;
+    for (conn = 0; conn < MOBILE_MAX_TCP_CONNECTIONS; conn++) {
+        if (s->connections[conn]) continue;
+        if (s->parked && s->parked_conn == conn) continue;
+        break;
+    }
+    if (conn >= MOBILE_MAX_TCP_CONNECTIONS) {
+        if (!s->parked) return -1;
+        conn = s->parked_conn;
+        connection_unpark(adapter);
     }
-    if (conn >= MOBILE_MAX_CONNECTIONS) return -1;
     return conn;
 }
 
@@ -85,7 +258,8 @@ static bool do_ppp_disconnect(struct mobile_adapter *adapter)
 
     // Clean up internet connections if connected to the internet
     if (s->state != MOBILE_CONNECTION_INTERNET) return false;
-    for (unsigned char conn = 0; conn < MOBILE_MAX_CONNECTIONS; conn++) {
+    connection_unpark(adapter);
+    for (unsigned char conn = 0; conn < MOBILE_MAX_TCP_CONNECTIONS; conn++) {
         if (s->connections[conn]) {
             mobile_cb_sock_close(adapter, conn);
             s->connections[conn] = false;
@@ -130,7 +304,12 @@ static void do_end_session(struct mobile_adapter *adapter)
     //   the command_wait_call function
     if (s->connections[p2p_conn]) mobile_cb_sock_close(adapter, p2p_conn);
 
+    connection_unpark(adapter);
     s->session_started = false;
+
+#ifdef MOBILE_ENABLE_SUMMARY
+    mobile_summary_end(adapter);
+#endif
 }
 
 static void do_start_session(struct mobile_adapter *adapter)
@@ -140,8 +319,14 @@ static void do_start_session(struct mobile_adapter *adapter)
     s->session_started = true;
     s->state = MOBILE_CONNECTION_DISCONNECTED;
     memset(s->connections, false, sizeof(s->connections));
+    s->parked = false;
 
-    mobile_number_fetch_cancel(adapter);
+#ifdef MOBILE_ENABLE_SUMMARY
+    mobile_summary_start(adapter);
+#endif
+#ifdef MOBILE_ENABLE_METRICS
+    mobile_metrics_add(adapter, sessions, 1);
+#endif
 }
 
 void mobile_commands_reset(struct mobile_adapter *adapter)
@@ -194,13 +379,43 @@ static struct mobile_packet *command_end(struct mobile_adapter *adapter, struct
 enum process_tel {
     PROCESS_TEL_BEGIN,
     PROCESS_TEL_IP,
+    PROCESS_TEL_RELAY_OPEN,
     PROCESS_TEL_RELAY
 };
 
+enum procdata_tel {
+    PROCDATA_TEL_REDIRECTS
+};
+
+// Maximum amount of relay redirects followed for a single call
+#define MAX_TEL_REDIRECTS 2
+
+// Connect to the relay server in <processing_addr> to place a call
+static struct mobile_packet *command_tel_relay_open(struct mobile_adapter *adapter, struct mobile_packet *packet)
+{
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
+
+    // Wait for the group to allow another relay connection
+    if (!mobile_group_relay_permit(adapter)) {
+        b->processing = PROCESS_TEL_RELAY_OPEN;
+        return NULL;
+    }
+
+    mobile_relay_init(adapter, p2p_conn);
+    if (!mobile_cb_sock_open(adapter, p2p_conn, MOBILE_SOCKTYPE_TCP,
+            b->processing_addr.type, 0)) {
+        return error_packet(packet, 3);
+    }
+    connection_opened(adapter, p2p_conn);
+
+    b->processing = PROCESS_TEL_RELAY;
+    return NULL;
+}
+
 static struct mobile_packet *command_tel_begin(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     if (s->state != MOBILE_CONNECTION_DISCONNECTED &&
             s->state != MOBILE_CONNECTION_WAIT &&
@@ -210,6 +425,9 @@ static struct mobile_packet *command_tel_begin(struct mobile_adapter *adapter, s
     }
     if (packet->length < 1) return error_packet(packet, 2);
 
+    // Pretend the line is busy while draining, see mobile_drain()
+    if (adapter->global.draining) return error_packet(packet, 0);
+
     // Close any connection created by command_wait_call
     if (s->connections[p2p_conn]) {
         mobile_cb_sock_close(adapter, p2p_conn);
@@ -267,17 +485,14 @@ static struct mobile_packet *command_tel_begin(struct mobile_adapter *adapter, s
 
     // If the relay is enabled, start the connection
     if (adapter->config.relay.type != MOBILE_ADDRTYPE_NONE) {
-        mobile_addr_copy(&b->processing_addr, &adapter->config.relay);
-        mobile_relay_init(adapter);
+        b->processing_data[PROCDATA_TEL_REDIRECTS] = 0;
 
-        if (!mobile_cb_sock_open(adapter, p2p_conn, MOBILE_SOCKTYPE_TCP,
-                b->processing_addr.type, 0)) {
-            return error_packet(packet, 3);
-        }
-        s->connections[p2p_conn] = true;
-
-        b->processing = PROCESS_TEL_RELAY;
-        return NULL;
+        // Go straight to the server known to serve this number, if any
+        const struct mobile_addr *server = mobile_relay_redirect_get(adapter,
+            (char *)packet->data + 1, packet->length - 1);
+        if (!server) server = &adapter->config.relay;
+        mobile_addr_copy(&b->processing_addr, server);
+        return command_tel_relay_open(adapter, packet);
     }
 
     // Interpret the number as an IP and connect to someone
@@ -294,7 +509,7 @@ static struct mobile_packet *command_tel_begin(struct mobile_adapter *adapter, s
                 b->processing_addr.type, 0)) {
             return error_packet(packet, 3);
         }
-        s->connections[p2p_conn] = true;
+        connection_opened(adapter, p2p_conn);
 
         b->processing = PROCESS_TEL_IP;
         return NULL;
@@ -306,7 +521,7 @@ static struct mobile_packet *command_tel_begin(struct mobile_adapter *adapter, s
 static struct mobile_packet *command_tel_ip(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     // Check if we're connected until it either errors or succeeds
     int rc = mobile_cb_sock_connect(adapter, p2p_conn, &b->processing_addr);
@@ -334,17 +549,46 @@ static struct mobile_packet *command_tel_ip(struct mobile_adapter *adapter, stru
 static struct mobile_packet *command_tel_relay(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
+
+    const char *number = (char *)packet->data + 1;
+    unsigned number_len = packet->length - 1;
 
     int rc = mobile_relay_proc_call(adapter, p2p_conn, &b->processing_addr,
-        (char *)packet->data + 1, packet->length - 1);
+        number, number_len);
     if (rc == 0) return NULL;
+    if (rc < 0 || rc == MOBILE_RELAY_CALL_RESULT_UNAVAILABLE) {
+        // The remembered server might not be valid anymore
+        mobile_relay_redirect_forget(adapter, number, number_len);
+    }
     if (rc < 0) {
         mobile_cb_sock_close(adapter, p2p_conn);
         s->connections[p2p_conn] = false;
         return error_packet(packet, 3);
     }
 
+    // Restart the call on the server serving the number
+    if (rc == MOBILE_RELAY_CALL_RESULT_REDIRECT) {
+        mobile_cb_sock_close(adapter, p2p_conn);
+        s->connections[p2p_conn] = false;
+
+        const struct mobile_addr *server =
+            mobile_relay_redirect_get(adapter, number, number_len);
+        if (!server || b->processing_data[PROCDATA_TEL_REDIRECTS]++ >=
+                MAX_TEL_REDIRECTS) {
+            return error_packet(packet, 3);
+        }
+        mobile_addr_copy(&b->processing_addr, server);
+        mobile_relay_init(adapter, p2p_conn);
+
+        if (!mobile_cb_sock_open(adapter, p2p_conn, MOBILE_SOCKTYPE_TCP,
+                b->processing_addr.type, 0)) {
+            return error_packet(packet, 3);
+        }
+        connection_opened(adapter, p2p_conn);
+        return NULL;
+    }
+
     // Interpret the result
     int errcode;
     switch (rc) {
@@ -376,23 +620,32 @@ static struct mobile_packet *command_tel_relay(struct mobile_adapter *adapter, s
 static struct mobile_packet *command_tel(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     switch (b->processing) {
     case PROCESS_TEL_BEGIN:
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_COMMAND);
+        mobile_time_latch(adapter, MOBILE_TIMER_COMMAND);
         return command_tel_begin(adapter, packet);
 
     case PROCESS_TEL_IP:
-        if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 60000)) {
+        if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_CONNECT)) {
             mobile_cb_sock_close(adapter, p2p_conn);
             s->connections[p2p_conn] = false;
             return error_packet(packet, 3);
         }
         return command_tel_ip(adapter, packet);
 
+    case PROCESS_TEL_RELAY_OPEN:
+        if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_CONNECT)) {
+            return error_packet(packet, 3);
+        }
+        return command_tel_relay_open(adapter, packet);
+
     case PROCESS_TEL_RELAY:
-        if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 60000)) {
+        if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_CONNECT)) {
             mobile_cb_sock_close(adapter, p2p_conn);
             s->connections[p2p_conn] = false;
             return error_packet(packet, 3);
@@ -421,21 +674,26 @@ enum process_wait_call {
 static struct mobile_packet *command_wait_call_begin(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     // Time out if anything fails
     s->state = MOBILE_CONNECTION_WAIT_TIMEOUT;
 
     if (adapter->config.relay.type != MOBILE_ADDRTYPE_NONE) {
+        // No call can be received until the group allows connecting
+        if (!mobile_group_relay_permit(adapter)) {
+            return error_packet(packet, 0);
+        }
+
         mobile_addr_copy(&b->processing_addr, &adapter->config.relay);
-        mobile_relay_init(adapter);
+        mobile_relay_init(adapter, p2p_conn);
 
         // Open the relay connection
         if (!mobile_cb_sock_open(adapter, p2p_conn, MOBILE_SOCKTYPE_TCP,
                 b->processing_addr.type, 0)) {
             return error_packet(packet, 0);
         }
-        s->connections[p2p_conn] = true;
+        connection_opened(adapter, p2p_conn);
 
         s->state = MOBILE_CONNECTION_WAIT_RELAY;
         return NULL;
@@ -450,7 +708,7 @@ static struct mobile_packet *command_wait_call_begin(struct mobile_adapter *adap
         mobile_cb_sock_close(adapter, p2p_conn);
         return error_packet(packet, 0);
     }
-    s->connections[p2p_conn] = true;
+    connection_opened(adapter, p2p_conn);
 
     s->state = MOBILE_CONNECTION_WAIT;
     return NULL;
@@ -473,7 +731,7 @@ static struct mobile_packet *command_wait_call_ip(struct mobile_adapter *adapter
 static struct mobile_packet *command_wait_call_relay(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     // Connect to the server and wait for a call
     int rc = mobile_relay_proc_wait(adapter, p2p_conn, &b->processing_addr);
@@ -513,7 +771,7 @@ static struct mobile_packet *command_wait_call_relay(struct mobile_adapter *adap
 static struct mobile_packet *command_wait_call(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     if (s->state != MOBILE_CONNECTION_DISCONNECTED &&
             s->state != MOBILE_CONNECTION_WAIT &&
@@ -523,16 +781,26 @@ static struct mobile_packet *command_wait_call(struct mobile_adapter *adapter, s
     }
 
     if (b->processing == PROCESS_WAIT_CALL_INIT) {
+        // Stop waiting for calls while draining, see mobile_drain()
+        if (adapter->global.draining) {
+            if (s->connections[p2p_conn]) {
+                mobile_cb_sock_close(adapter, p2p_conn);
+                s->connections[p2p_conn] = false;
+            }
+            s->state = MOBILE_CONNECTION_DISCONNECTED;
+            return error_packet(packet, 0);
+        }
+
         // If a previous timeout is in effect, wait it out
         if (s->state == MOBILE_CONNECTION_WAIT_TIMEOUT) {
-            if (!mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND,
-                    1000)) {
+            if (!mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                    MOBILE_TIMEOUT_WAIT_CALL)) {
                 return NULL;
             }
             s->state = MOBILE_CONNECTION_DISCONNECTED;
         }
 
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_COMMAND);
+        mobile_time_latch(adapter, MOBILE_TIMER_COMMAND);
         b->processing = PROCESS_WAIT_CALL_INIT_DONE;
     }
 
@@ -544,16 +812,19 @@ static struct mobile_packet *command_wait_call(struct mobile_adapter *adapter, s
         return command_wait_call_begin(adapter, packet);
 
     case MOBILE_CONNECTION_WAIT:
-        if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 1000)) {
+        if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_WAIT_CALL)) {
             return error_packet(packet, 0);
         }
         return command_wait_call_ip(adapter, packet);
 
     case MOBILE_CONNECTION_WAIT_RELAY:
-        if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 1000)) {
+        if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_WAIT_CALL)) {
             // If not done connecting to the server, the connection is hanging
             // Treat it as if the connection failed
-            if (adapter->relay.state != MOBILE_RELAY_RECV_WAIT) {
+            if (adapter->buffer->relay_state.call.state !=
+                    MOBILE_RELAY_RECV_WAIT) {
                 mobile_cb_sock_close(adapter, p2p_conn);
                 s->connections[p2p_conn] = false;
                 s->state = MOBILE_CONNECTION_DISCONNECTED;
@@ -580,7 +851,7 @@ enum procdata_data {
 static struct mobile_packet *command_data(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     if (s->state != MOBILE_CONNECTION_CALL &&
             s->state != MOBILE_CONNECTION_CALL_RECV &&
@@ -595,13 +866,13 @@ static struct mobile_packet *command_data(struct mobile_adapter *adapter, struct
     // P2P connections use ID 0xff, but the adapter ignores this
     if (!internet) conn = p2p_conn;
 
-    if (conn >= MOBILE_MAX_CONNECTIONS || !s->connections[conn]) {
+    if (conn >= MOBILE_MAX_TCP_CONNECTIONS || !s->connections[conn]) {
         return error_packet(packet, 0);
     }
 
     if (b->processing == PROCESS_DATA_INIT) {
         b->processing_data[PROCDATA_DATA_SENT_SIZE] = 0;
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_COMMAND);
+        mobile_time_latch(adapter, MOBILE_TIMER_COMMAND);
         b->processing = PROCESS_DATA_INIT_DONE;
     }
 
@@ -615,12 +886,13 @@ static struct mobile_packet *command_data(struct mobile_adapter *adapter, struct
         if (rc < 0) return error_packet(packet, 0);
         sent_size += rc;
         b->processing_data[PROCDATA_DATA_SENT_SIZE] = sent_size;
+        connection_timing_update(adapter, conn, rc, 0);
 
         // Attempt to send again while not everything has been sent
         if (send_size > sent_size) {
             // TODO: Verify the timeout with a game
-            if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND,
-                    10000)) {
+            if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                    MOBILE_TIMEOUT_SEND)) {
                 return error_packet(packet, 0);
             }
             return NULL;
@@ -643,6 +915,7 @@ static struct mobile_packet *command_data(struct mobile_adapter *adapter, struct
     if (!internet && recv_size > 0) {
         if (s->call_packets_sent > 0) s->call_packets_sent--;
     }
+    if (recv_size > 0) connection_timing_update(adapter, conn, 0, recv_size);
 
     // If connected to the internet, and a disconnect is received, we should
     // inform the game about a remote disconnect.
@@ -660,10 +933,11 @@ static struct mobile_packet *command_data(struct mobile_adapter *adapter, struct
     // Any other errors should raise a proper error
     if (recv_size < 0) return error_packet(packet, 0);
 
-    // If nothing was sent, try to receive for at least one second
+    // If nothing was sent, try to receive for a while
     // TODO: Don't delay for UDP connections
     if (internet && !send_size && !recv_size &&
-            !mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 1000)) {
+            !mobile_time_check_ms(adapter, MOBILE_TIMER_COMMAND,
+                connection_recv_wait(adapter, conn))) {
         return NULL;
     }
 
@@ -804,6 +1078,7 @@ static struct mobile_packet *command_ppp_connect(struct mobile_adapter *adapter,
     if (s->state != MOBILE_CONNECTION_CALL_ISP) {
         return error_packet(packet, 1);
     }
+    if (adapter->global.draining) return error_packet(packet, 3);
 
     // Make sure we aren't connected to an actual phone
     if (s->connections[p2p_conn]) return error_packet(packet, 3);
@@ -891,21 +1166,34 @@ enum procdata_tcp_connect {
 static struct mobile_packet *command_tcp_connect_begin(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     if (s->state != MOBILE_CONNECTION_INTERNET) {
         return error_packet(packet, 1);
     }
     if (packet->length < 6) return error_packet(packet, 3);
 
-    int conn = connection_new(adapter);
+    // Resume a previous attempt to connect to this address
+    struct mobile_addr4 addr = {
+        .type = MOBILE_ADDRTYPE_IPV4,
+        .port = packet->data[4] << 8 | packet->data[5],
+    };
+    memcpy(addr.host, packet->data, 4);
+    int conn = connection_adopt(adapter, (struct mobile_addr *)&addr);
+    if (conn >= 0) {
+        b->processing_data[PROCDATA_TCP_CONNECT_CONN] = conn;
+        b->processing = PROCESS_TCP_CONNECT_CONNECTING;
+        return NULL;
+    }
+
+    conn = connection_new(adapter);
     if (conn < 0) return error_packet(packet, 0);
 
     if (!mobile_cb_sock_open(adapter, conn, MOBILE_SOCKTYPE_TCP,
             MOBILE_ADDRTYPE_IPV4, 0)) {
         return error_packet(packet, 3);
     }
-    s->connections[conn] = true;
+    connection_opened(adapter, conn);
 
     b->processing_data[PROCDATA_TCP_CONNECT_CONN] = conn;
     b->processing = PROCESS_TCP_CONNECT_CONNECTING;
@@ -915,7 +1203,7 @@ static struct mobile_packet *command_tcp_connect_begin(struct mobile_adapter *ad
 static struct mobile_packet *command_tcp_connect_connecting(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     unsigned char conn = b->processing_data[PROCDATA_TCP_CONNECT_CONN];
 
@@ -945,21 +1233,25 @@ static struct mobile_packet *command_tcp_connect_connecting(struct mobile_adapte
 // 3 - Connection failed
 static struct mobile_packet *command_tcp_connect(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
-    struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     switch (b->processing) {
     case PROCESS_TCP_CONNECT_BEGIN:
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_COMMAND);
+        mobile_time_latch(adapter, MOBILE_TIMER_COMMAND);
         return command_tcp_connect_begin(adapter, packet);
 
     case PROCESS_TCP_CONNECT_CONNECTING:
         // TODO: Verify this timeout with a game
-        if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 60000)) {
-            unsigned char conn =
-                b->processing_data[PROCDATA_TCP_CONNECT_CONN];
-            mobile_cb_sock_close(adapter, conn);
-            s->connections[conn] = false;
+        if (mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_CONNECT)) {
+            struct mobile_addr4 addr = {
+                .type = MOBILE_ADDRTYPE_IPV4,
+                .port = packet->data[4] << 8 | packet->data[5],
+            };
+            memcpy(addr.host, packet->data, 4);
+            connection_park(adapter,
+                b->processing_data[PROCDATA_TCP_CONNECT_CONN],
+                (struct mobile_addr *)&addr);
             return error_packet(packet, 3);
         }
         return command_tcp_connect_connecting(adapter, packet);
@@ -985,7 +1277,7 @@ static struct mobile_packet *command_tcp_disconnect(struct mobile_adapter *adapt
     }
 
     unsigned char conn = packet->data[0];
-    if (conn >= MOBILE_MAX_CONNECTIONS || !s->connections[conn]) {
+    if (conn >= MOBILE_MAX_TCP_CONNECTIONS || !s->connections[conn]) {
         return error_packet(packet, 0);  // UNKERR
     }
     mobile_cb_sock_close(adapter, conn);
@@ -1048,8 +1340,7 @@ static struct mobile_addr *dns_get_addr(struct mobile_adapter *adapter, unsigned
 
 static int dns_request_start(struct mobile_adapter *adapter, struct mobile_packet *packet, unsigned conn, unsigned addr_id)
 {
-    struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     // Check any of the DNS addresses to see if they can be used
     // Fall through from DNS1 into DNS2 if DNS1 can't be used
@@ -1071,9 +1362,9 @@ static int dns_request_start(struct mobile_adapter *adapter, struct mobile_packe
         mobile_cb_sock_close(adapter, conn);
         return -1;
     }
-    s->connections[conn] = true;
+    connection_opened(adapter, conn);
 
-    mobile_cb_time_latch(adapter, MOBILE_TIMER_COMMAND);
+    mobile_time_latch(adapter, MOBILE_TIMER_COMMAND);
 
     // Return the DNS ID that was used
     return (int)addr_id;
@@ -1082,7 +1373,7 @@ static int dns_request_start(struct mobile_adapter *adapter, struct mobile_packe
 static struct mobile_packet *command_dns_request_begin(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     if (s->state != MOBILE_CONNECTION_INTERNET) {
         return error_packet(packet, 1);
@@ -1119,7 +1410,7 @@ static struct mobile_packet *command_dns_request_begin(struct mobile_adapter *ad
 static struct mobile_packet *command_dns_request_check(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
     struct mobile_adapter_commands *s = &adapter->commands;
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     unsigned char conn = b->processing_data[PROCDATA_DNS_REQUEST_CONN];
     int addr_id = b->processing_data[PROCDATA_DNS_REQUEST_ADDR_ID];
@@ -1128,7 +1419,8 @@ static struct mobile_packet *command_dns_request_check(struct mobile_adapter *ad
     int rc = mobile_dns_request_recv(adapter, conn, &b->processing_addr,
         (char *)packet->data, packet->length, ip);
     if (rc == 0 &&
-            !mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 3000)) {
+            !mobile_time_check_timeout(adapter, MOBILE_TIMER_COMMAND,
+                MOBILE_TIMEOUT_DNS)) {
         return NULL;
     }
 
@@ -1161,7 +1453,7 @@ static struct mobile_packet *command_dns_request_check(struct mobile_adapter *ad
 // 2 - Invalid contents/lookup failed
 static struct mobile_packet *command_dns_request(struct mobile_adapter *adapter, struct mobile_packet *packet)
 {
-    struct mobile_buffer_commands *b = &adapter->buffer.commands;
+    struct mobile_buffer_commands *b = &adapter->buffer->commands;
 
     switch (b->processing) {
     case PROCESS_DNS_REQUEST_BEGIN:
@@ -6,6 +6,9 @@
 #include "mobile.h"
 #include "atomic.h"
 
+// Connections available to the game, the rest are used internally
+#define MOBILE_MAX_TCP_CONNECTIONS 2
+
 enum mobile_command {
     MOBILE_COMMAND_NULL = 0xF,
     MOBILE_COMMAND_START,
@@ -58,12 +61,41 @@ struct mobile_buffer_commands {
     struct mobile_addr processing_addr;
 };
 
+// Timing of the data exchanged over a connection
+struct mobile_connection_timing {
+    uint32_t last_activity;
+    uint32_t send_time;  // Time of the oldest send without a reply
+    bool awaiting;
+    bool measured;
+    uint32_t srtt;  // Smoothed round trip time, multiplied by 8
+    uint32_t rttvar;  // Round trip time variation, multiplied by 4
+
+    // Throughput, measured over windows of at least TIMING_WINDOW_MS
+    uint32_t window_start;
+    uint32_t window_bytes;
+    uint32_t throughput;
+
+    uint32_t bytes_sent;
+    uint32_t bytes_recv;
+};
+
+// Connection state only used during a session
+struct mobile_buffer_connections {
+    struct mobile_connection_timing timing[MOBILE_MAX_TCP_CONNECTIONS];
+    struct mobile_addr parked_addr;
+};
+
 struct mobile_adapter_commands {
     _Atomic volatile bool session_started;
     _Atomic volatile bool mode_32bit;
 
     enum mobile_connection_state state;
-    bool connections[MOBILE_MAX_CONNECTIONS];
+    bool connections[MOBILE_MAX_TCP_CONNECTIONS];
+
+    // TCP connection attempt that timed out, kept in case the game retries it
+    bool parked;
+    unsigned char parked_conn;
+
     bool dns2_use;
     unsigned char call_packets_sent;
     struct mobile_addr4 dns1;
@@ -74,5 +106,7 @@ void mobile_commands_init(struct mobile_adapter *adapter);
 void mobile_commands_reset(struct mobile_adapter *adapter);
 struct mobile_packet *mobile_commands_process(struct mobile_adapter *adapter, struct mobile_packet *packet);
 bool mobile_commands_exists(enum mobile_command command);
+bool mobile_commands_parked_expired(struct mobile_adapter *adapter);
+void mobile_commands_parked_expire(struct mobile_adapter *adapter);
 
 #undef _Atomic  // "atomic.h"
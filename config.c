@@ -200,6 +200,9 @@ void mobile_config_load(struct mobile_adapter *adapter)
     if (!config_internal_verify(adapter)) config_internal_clear(adapter);
     if (config_library_load(adapter)) adapter->config.dirty = false;
     adapter->config.loaded = true;
+
+    // The token may have changed
+    mobile_relay_number_forget(adapter);
 }
 
 void mobile_config_save(struct mobile_adapter *adapter)
@@ -264,6 +267,8 @@ void mobile_config_set_relay(struct mobile_adapter *adapter, const struct mobile
 {
     // Latched whenever a number a dialed or the wait command is executed
     mobile_addr_copy(&adapter->config.relay, relay);
+    mobile_relay_redirect_clear(adapter);
+    mobile_relay_number_forget(adapter);
 
     mobile_config_apply(adapter);
     mobile_number_fetch_reset(adapter);
@@ -287,6 +292,7 @@ void mobile_config_set_relay_token_internal(struct mobile_adapter *adapter, cons
 void mobile_config_set_relay_token(struct mobile_adapter *adapter, const unsigned char *token)
 {
     mobile_config_set_relay_token_internal(adapter, token);
+    mobile_relay_number_forget(adapter);
     mobile_number_fetch_reset(adapter);
 }
 
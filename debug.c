@@ -10,7 +10,57 @@
 
 void mobile_debug_init(struct mobile_adapter *adapter)
 {
-    adapter->debug.current = 0;
+    struct mobile_adapter_debug *s = &adapter->debug;
+
+    s->current = 0;
+    s->enabled = true;
+    s->interval = 1;
+    s->countdown = 0;
+    s->threshold = 0;
+    s->command_start = 0;
+}
+
+static void debug_enable(struct mobile_adapter *adapter, bool enabled)
+{
+    struct mobile_adapter_debug *s = &adapter->debug;
+
+    // Drop any partially written line
+    if (s->enabled != enabled) s->current = 0;
+    s->enabled = enabled;
+}
+
+void mobile_debug_set_sampling(struct mobile_adapter *adapter, unsigned interval, unsigned threshold_ms)
+{
+    struct mobile_adapter_debug *s = &adapter->debug;
+
+    s->interval = interval;
+    s->countdown = 0;
+    s->threshold = threshold_ms;
+    debug_enable(adapter, interval == 1);
+}
+
+// Decide whether the session that's starting will be logged
+static void debug_session_start(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_debug *s = &adapter->debug;
+
+    if (!s->interval) {
+        debug_enable(adapter, false);
+        return;
+    }
+    debug_enable(adapter, s->countdown == 0);
+    if (++s->countdown >= s->interval) s->countdown = 0;
+}
+
+// Sampling only applies within sessions, anything logged outside of them is
+//   always written out
+static bool debug_enabled(struct mobile_adapter *adapter)
+{
+#ifdef MOBILE_ENABLE_POOL
+    // Lines are built in the leased buffer, nothing is logged without one
+    if (!adapter->debug.buffer) return false;
+#endif
+    return adapter->debug.enabled || !adapter->commands.session_started;
 }
 
 #define debug_write(data, size) mobile_debug_write(adapter, (const char *)data, size)
@@ -21,6 +71,8 @@ void mobile_debug_write(struct mobile_adapter *adapter, const char *data, size_t
 {
     struct mobile_adapter_debug *s = &adapter->debug;
 
+    if (!debug_enabled(adapter)) return;
+
     int remaining = MOBILE_DEBUG_BUFFER_SIZE - s->current;
     if (remaining <= 1) return;
     int written = (int)size;
@@ -32,21 +84,22 @@ void mobile_debug_write(struct mobile_adapter *adapter, const char *data, size_t
 
 void mobile_debug_print(struct mobile_adapter *adapter, const char *fmt, ...)
 {
-    va_list ap;
-    va_start(ap, fmt);
-
     struct mobile_adapter_debug *s = &adapter->debug;
 
+    if (!debug_enabled(adapter)) return;
+
     int remaining = MOBILE_DEBUG_BUFFER_SIZE - s->current;
     if (remaining <= 1) return;
+
+    va_list ap;
+    va_start(ap, fmt);
     int written = vsnprintf_P(s->buffer + s->current, remaining, fmt, ap);
+    va_end(ap);
     if (written <= 0) return;
-    s->current += written;
 
     // Remove the terminator 0 from the s->current size
-    if (s->current >= MOBILE_DEBUG_BUFFER_SIZE) {
-        s->current = MOBILE_DEBUG_BUFFER_SIZE - 1;
-    }
+    if (written > remaining - 1) written = remaining - 1;
+    s->current += written;
 }
 
 void mobile_debug_print_hex(struct mobile_adapter *adapter, const void *data, size_t size)
@@ -79,6 +132,7 @@ void mobile_debug_endl(struct mobile_adapter *adapter)
     struct mobile_adapter_debug *s = &adapter->debug;
 
     // Write the current line out
+    if (!debug_enabled(adapter)) return;
     mobile_cb_debug_log(adapter, s->current ? s->buffer : "");
     s->current = 0;
 }
@@ -133,6 +187,25 @@ static void packet_end(struct mobile_adapter *adapter, const struct mobile_packe
 
 void mobile_debug_command(struct mobile_adapter *adapter, const struct mobile_packet *packet, bool send)
 {
+    struct mobile_adapter_debug *s = &adapter->debug;
+
+    // Sessions are sampled as soon as the START command is received, so it
+    //   can be logged along with the rest of the session.
+    // Start logging a session that wasn't sampled once a command is slow.
+    if (!send) {
+        if (packet->command == MOBILE_COMMAND_START &&
+                !adapter->commands.session_started) {
+            debug_session_start(adapter);
+        }
+        s->command_start = mobile_time_now(adapter);
+    } else if (!s->enabled && s->threshold &&
+            mobile_time_now(adapter) - s->command_start >= s->threshold) {
+        debug_enable(adapter, true);
+        debug_print("!!! Slow command, logging the rest of the session");
+        debug_endl();
+    }
+    if (!s->enabled) return;
+
     if (!send) debug_print(">>> ");
     else debug_print("<<< ");
 
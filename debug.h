@@ -1,8 +1,14 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 #pragma once
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
 struct mobile_adapter;
 struct mobile_packet;
 struct mobile_addr;
@@ -11,7 +17,23 @@ struct mobile_addr;
 
 struct mobile_adapter_debug {
     unsigned char current;
+
+    // Whether the current session is logged, decided at its start
+    bool enabled;
+
+    // Sampling policy, see mobile_debug_set_sampling()
+    unsigned interval;
+    unsigned countdown;
+    unsigned threshold;
+    uint32_t command_start;
+
+#ifndef MOBILE_ENABLE_POOL
     char buffer[MOBILE_DEBUG_BUFFER_SIZE];
+#else
+    // Leased from the pool along with the other buffers, nothing is logged
+    //   while none is leased
+    char *buffer;
+#endif
 };
 
 void mobile_debug_write(struct mobile_adapter *adapter, const char *data, size_t size);
@@ -221,7 +221,7 @@ static int dns_get_answer(struct mobile_buffer_dns *state, unsigned *offset, con
 bool mobile_dns_request_send(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr_send, const char *host, unsigned host_len)
 {
     struct mobile_adapter_dns *s = &adapter->dns;
-    struct mobile_buffer_dns *b = &adapter->buffer.dns;
+    struct mobile_buffer_dns *b = &adapter->buffer->dns;
 
     if (!dns_make_query(b, ++s->id, DNS_QTYPE_A, host, host_len)) return false;
 
@@ -235,7 +235,7 @@ bool mobile_dns_request_send(struct mobile_adapter *adapter, unsigned conn, cons
 // Returns: -1 on error, 0 if processing, 1 on success
 int mobile_dns_request_recv(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr_send, const char *host, unsigned host_len, unsigned char *ip)
 {
-    struct mobile_buffer_dns *b = &adapter->buffer.dns;
+    struct mobile_buffer_dns *b = &adapter->buffer->dns;
 
     struct mobile_addr addr_recv = {0};
     int recv = mobile_cb_sock_recv(adapter, conn, b->data,
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "framing.h"
+
+#include <string.h>
+
+#include "compat.h"
+
+// Table-driven receiver for the packet framing, see framing.h
+// Every byte is classified, and looked up along with the current stage to
+//   find what to do with it. The stages that count bytes move on once their
+//   length has been reached, skipping any stage that turns out to be empty.
+
+enum framing_class {
+    CLASS_OTHER,
+    CLASS_SYNC1,  // 0x99
+    CLASS_SYNC2,  // 0x66
+    MAX_CLASSES
+};
+
+enum framing_action {
+    ACTION_NONE,
+    ACTION_SYNC,
+    ACTION_BEGIN,
+
+    // Actions that count bytes
+    ACTION_HEADER,
+    ACTION_DATA,
+    ACTION_PAD,
+    ACTION_FOOTER
+};
+
+struct framing_transition {
+    unsigned char action;
+    unsigned char next;
+};
+
+static const struct framing_transition framing_table[MOBILE_MAX_FRAMING_STAGES][MAX_CLASSES] PROGMEM = {
+#define X(stage, a1, n1, a2, n2, a0, n0, done) \
+    [MOBILE_FRAMING_ ## stage] = { \
+        [CLASS_OTHER] = {ACTION_ ## a0, MOBILE_FRAMING_ ## n0}, \
+        [CLASS_SYNC1] = {ACTION_ ## a1, MOBILE_FRAMING_ ## n1}, \
+        [CLASS_SYNC2] = {ACTION_ ## a2, MOBILE_FRAMING_ ## n2}, \
+    },
+    MOBILE_FRAMING_TABLE(X)
+#undef X
+};
+
+static const unsigned char framing_complete[MOBILE_MAX_FRAMING_STAGES] PROGMEM = {
+#define X(stage, a1, n1, a2, n2, a0, n0, done) \
+    [MOBILE_FRAMING_ ## stage] = MOBILE_FRAMING_ ## done,
+    MOBILE_FRAMING_TABLE(X)
+#undef X
+};
+
+// Amount of bytes in a stage, once the header is known
+static unsigned framing_length(const struct mobile_framing *f, unsigned char stage, bool mode_32bit)
+{
+    switch (stage) {
+    case MOBILE_FRAMING_HEADER:
+        return sizeof(f->header);
+    case MOBILE_FRAMING_DATA:
+        // Data size is a u16be, but it may not be bigger than 0xff...
+        return f->header[3];
+    case MOBILE_FRAMING_DATA_PAD:
+        if (!mode_32bit || !(f->header[3] % 4)) return 0;
+        return 4 - (f->header[3] % 4);
+    case MOBILE_FRAMING_CHECKSUM:
+        return sizeof(f->footer);
+    default:
+        return 1;
+    }
+}
+
+// Receive a single byte, storing the header and footer in <f>, and the data
+//   in <data>.
+// Returns: the event that this byte caused
+enum mobile_framing_event mobile_framing_receive(struct mobile_framing *f, unsigned char *stage, unsigned char *data, bool mode_32bit, uint8_t c)
+{
+    unsigned char class = CLASS_OTHER;
+    if (c == 0x99) class = CLASS_SYNC1;
+    if (c == 0x66) class = CLASS_SYNC2;
+
+    struct framing_transition t;
+    memcpy_P(&t, &framing_table[*stage][class], sizeof(t));
+    *stage = t.next;
+
+    switch (t.action) {
+    case ACTION_SYNC:
+        return MOBILE_FRAMING_EVENT_SYNC;
+
+    case ACTION_BEGIN:
+        f->checksum = 0;
+        f->current = 0;
+        return MOBILE_FRAMING_EVENT_NONE;
+
+    case ACTION_HEADER:
+        f->header[f->current++] = c;
+        f->checksum += c;
+        break;
+
+    case ACTION_DATA:
+        data[f->current++] = c;
+        f->checksum += c;
+        break;
+
+    case ACTION_PAD:
+        f->current++;
+        break;
+
+    case ACTION_FOOTER:
+        f->footer[f->current++] = c;
+        break;
+
+    default:
+        return MOBILE_FRAMING_EVENT_NONE;
+    }
+
+    if (f->current < framing_length(f, *stage, mode_32bit)) {
+        return MOBILE_FRAMING_EVENT_NONE;
+    }
+
+    enum mobile_framing_event event = MOBILE_FRAMING_EVENT_NONE;
+    if (*stage == MOBILE_FRAMING_HEADER) event = MOBILE_FRAMING_EVENT_HEADER;
+    if (*stage == MOBILE_FRAMING_CHECKSUM) event = MOBILE_FRAMING_EVENT_DONE;
+
+    f->current = 0;
+    do {
+        memcpy_P(stage, &framing_complete[*stage], 1);
+    } while (*stage != MOBILE_FRAMING_WAITING &&
+        !framing_length(f, *stage, mode_32bit));
+    return event;
+}
+
+// Returns: the amount of bytes left until the packet has been received,
+//   assuming it carries no data if the header hasn't been received yet.
+unsigned mobile_framing_remaining(const struct mobile_framing *f, unsigned char stage, bool mode_32bit)
+{
+    unsigned count = sizeof(f->footer);
+    switch (stage) {
+    case MOBILE_FRAMING_WAITING:
+        count += 2 + sizeof(f->header);
+        break;
+    case MOBILE_FRAMING_PREAMBLE:
+        count += 1 + sizeof(f->header);
+        break;
+    case MOBILE_FRAMING_HEADER:
+        count += sizeof(f->header) - f->current;
+        break;
+    case MOBILE_FRAMING_DATA:
+        count += framing_length(f, MOBILE_FRAMING_DATA, mode_32bit) +
+            framing_length(f, MOBILE_FRAMING_DATA_PAD, mode_32bit) -
+            f->current;
+        break;
+    case MOBILE_FRAMING_DATA_PAD:
+        count += framing_length(f, MOBILE_FRAMING_DATA_PAD, mode_32bit) -
+            f->current;
+        break;
+    case MOBILE_FRAMING_CHECKSUM:
+        count -= f->current;
+        break;
+    default:
+        break;
+    }
+    return count;
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Framing of the packets received over the serial link
+// Every packet consists of a preamble, header, data, padding (32bit mode
+//   only) and checksum. The stages of receiving one are described once, in
+//   MOBILE_FRAMING_TABLE, from which the transition tables in framing.c are
+//   built. Both serial.c and sniffer.c number their receiving states after
+//   these stages, in the same order.
+
+// X(stage, action on 0x99, next, on 0x66, next, on other bytes, next,
+//   stage that follows once all bytes of the stage have been received)
+#define MOBILE_FRAMING_TABLE(X) \
+    X(WAITING, SYNC, PREAMBLE, NONE, WAITING, NONE, WAITING, \
+        WAITING) \
+    X(PREAMBLE, SYNC, PREAMBLE, BEGIN, HEADER, NONE, WAITING, \
+        WAITING) \
+    X(HEADER, HEADER, HEADER, HEADER, HEADER, HEADER, HEADER, \
+        DATA) \
+    X(DATA, DATA, DATA, DATA, DATA, DATA, DATA, \
+        DATA_PAD) \
+    X(DATA_PAD, PAD, DATA_PAD, PAD, DATA_PAD, PAD, DATA_PAD, \
+        CHECKSUM) \
+    X(CHECKSUM, FOOTER, CHECKSUM, FOOTER, CHECKSUM, FOOTER, CHECKSUM, \
+        WAITING)
+
+enum mobile_framing_stage {
+#define X(stage, ...) MOBILE_FRAMING_ ## stage,
+    MOBILE_FRAMING_TABLE(X)
+#undef X
+    MOBILE_MAX_FRAMING_STAGES
+};
+
+enum mobile_framing_event {
+    MOBILE_FRAMING_EVENT_NONE,
+    MOBILE_FRAMING_EVENT_SYNC,  // A packet might be starting
+    MOBILE_FRAMING_EVENT_HEADER,  // The header has been received
+    MOBILE_FRAMING_EVENT_DONE  // The checksum has been received
+};
+
+struct mobile_framing {
+    unsigned char current;
+    uint16_t checksum;
+    unsigned char header[4];
+    unsigned char footer[2];
+};
+
+enum mobile_framing_event mobile_framing_receive(struct mobile_framing *f, unsigned char *stage, unsigned char *data, bool mode_32bit, uint8_t c);
+unsigned mobile_framing_remaining(const struct mobile_framing *f, unsigned char stage, bool mode_32bit);
@@ -3,10 +3,35 @@
 
 // Exposes functions and data defined/used in mobile.c
 
+#include <stdint.h>
 #include <stdbool.h>
 
 #include "commands.h"
 
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
+// The number is fetched from the relay on a connection of its own
+#define MOBILE_NUMBER_FETCH_CONN MOBILE_MAX_TCP_CONNECTIONS
+
+// Attempts at fetching the number before giving up
+#define MOBILE_NUMBER_FETCH_RETRIES 3
+
+#if defined(MOBILE_ENABLE_SUMMARY) || defined(MOBILE_ENABLE_METRICS)
+// Command being processed, captured once by command_handle() for the session
+//   summary and the metrics
+struct mobile_command_record {
+    uint32_t start;  // Time at which the command was received
+    uint32_t ms;  // Time it took to reply to it
+    unsigned char command;
+    unsigned char conn;  // Connection used by the DATA command
+    unsigned char sent;  // Data sent by the DATA command
+    unsigned char recv;  // Data received by the DATA command
+    bool error;  // Whether the reply was an error
+};
+#endif
+
 struct mobile_adapter_global {
     // Whether the adapter is turned on or not
     bool start: 1;
@@ -21,9 +46,31 @@ struct mobile_adapter_global {
     // Whether the relay connection is currently open
     bool number_fetch_active: 1;
 
+    // Whether mobile_func_sock_connect_data() is supported, once known
+    bool connect_data_checked: 1;
+    bool connect_data: 1;
+
+    // Whether new connections are refused, see mobile_drain()
+    bool draining: 1;
+
     // Remaining retries for initializing the relay number
     unsigned char number_fetch_retries;
+
+    // Time to wait before attempting the number fetch, since
+    //   MOBILE_TIMER_NUMBER_FETCH was latched, see number_fetch_backoff()
+    unsigned number_fetch_delay;
+
+    // State of the pseudo-random generator used to spread out retries
+    uint32_t jitter;
+
+#if defined(MOBILE_ENABLE_SUMMARY) || defined(MOBILE_ENABLE_METRICS)
+    struct mobile_command_record command;
+#endif
 };
 
 void mobile_number_fetch_cancel(struct mobile_adapter *adapter);
 void mobile_number_fetch_reset(struct mobile_adapter *adapter);
+#if defined(MOBILE_ENABLE_SUMMARY) || defined(MOBILE_ENABLE_METRICS)
+unsigned mobile_latency_bucket(uint32_t ms);
+#endif
+int mobile_sock_connect_data(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr, const void *data, unsigned size);
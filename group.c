@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "group.h"
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Adapter groups
+// A group lets a host event loop service many adapters without calling
+//   mobile_loop() on all of them periodically. Adapters are only serviced when
+//   something happened to them (a packet was received from the game, or the
+//   host signaled activity on their sockets), and periodically while they're
+//   busy. Idle adapters are only serviced now and then, to resynchronize the
+//   serial, and stopped adapters cost nothing.
+
+void mobile_group_member_init(struct mobile_adapter *adapter)
+{
+    adapter->group.group = NULL;
+    adapter->group.next = NULL;
+    adapter->group.pending = false;
+    adapter->group.relay_permits = 0;
+    adapter->group.relay_permit_time = 0;
+}
+
+// Relay permits
+// Every relay connection opened by an adapter of a group with a relay limit
+//   takes a permit. An adapter returns all of its permits once relay_window
+//   milliseconds have passed since it took the newest one, as measured by
+//   mobile_time_now(), which follows the adapter's timer callbacks or its
+//   clock rate. This limits the rate at which the group connects to the
+//   relay, without the group needing a clock of its own. Adapters that are
+//   stopped return their permits early.
+
+static void group_relay_expire(struct mobile_group *group, struct mobile_adapter *adapter)
+{
+    if (!adapter->group.relay_permits) return;
+    if (adapter->global.start && mobile_time_now(adapter) -
+            adapter->group.relay_permit_time < group->relay_window) {
+        return;
+    }
+    group->relay_taken -= adapter->group.relay_permits;
+    adapter->group.relay_permits = 0;
+}
+
+// Returns: true if the adapter may open a connection to the relay now
+bool mobile_group_relay_permit(struct mobile_adapter *adapter)
+{
+    struct mobile_group *group = adapter->group.group;
+
+    if (!group || !group->relay_limit) return true;
+
+    group_relay_expire(group, adapter);
+    if (group->relay_taken >= group->relay_limit) return false;
+
+    group->relay_taken++;
+    adapter->group.relay_permits++;
+    adapter->group.relay_permit_time = mobile_time_now(adapter);
+    return true;
+}
+
+// Whether the adapter has anything to do without being notified
+static bool group_member_busy(struct mobile_adapter *adapter)
+{
+    if (!adapter->global.start) return false;
+    if (adapter->global.active) return true;
+    if (adapter->commands.session_started) return true;
+    if (adapter->config.dirty) return true;
+    if (adapter->global.number_fetch_active) return true;
+    return false;
+}
+
+void mobile_group_notify(struct mobile_adapter *adapter)
+{
+    struct mobile_group *group = adapter->group.group;
+
+    if (!group) return;
+    if (adapter->group.pending) return;
+    adapter->group.pending = true;
+    group->wake(group->user);
+}
+
+static void group_wait_min(int *wait, unsigned ms)
+{
+    if (*wait < 0 || ms < (unsigned)*wait) *wait = ms;
+}
+
+// Idle adapters only have to be serviced once one of their timers is due.
+//   Without any serial activity, there's no need to resynchronize the serial
+//   either, as the serial thread notifies the group once the game starts
+//   exchanging data, see mobile_transfer().
+// Returns: milliseconds until the adapter has to be serviced again, -1 if it
+//   doesn't until it's notified
+static int group_member_wait(struct mobile_group *group, struct mobile_adapter *adapter)
+{
+    if (!adapter->global.start) return -1;
+    if (group_member_busy(adapter)) return MOBILE_GROUP_INTERVAL_MS;
+
+    int wait = -1;
+
+    // Its permits are returned once the window has passed
+    if (adapter->group.relay_permits) {
+        uint32_t elapsed = mobile_time_now(adapter) -
+            adapter->group.relay_permit_time;
+        group_wait_min(&wait, elapsed >= group->relay_window ? 0 :
+            group->relay_window - elapsed);
+    }
+
+    // The number fetch is yet to run, once it's allowed to connect
+    if (adapter->global.number_fetch_retries &&
+            !adapter->global.draining &&
+            adapter->config.relay.type != MOBILE_ADDRTYPE_NONE &&
+            (!group->relay_limit || group->relay_taken < group->relay_limit)) {
+        group_wait_min(&wait, mobile_time_remaining(adapter,
+            MOBILE_TIMER_NUMBER_FETCH, adapter->global.number_fetch_delay));
+    }
+
+    // A timed out connection is kept for a while
+    if (adapter->commands.parked) {
+        group_wait_min(&wait, mobile_time_remaining(adapter,
+            MOBILE_TIMER_PARKED,
+            adapter->time.timeouts[MOBILE_TIMEOUT_PARKED]));
+    }
+
+    return wait;
+}
+
+// Returns: milliseconds until the next dispatch, -1 if there's no need for one
+int mobile_group_dispatch(struct mobile_group *group)
+{
+    int next = -1;
+
+    for (struct mobile_adapter *adapter = group->first; adapter;
+            adapter = adapter->group.next) {
+        // Catch up with the time of adapters that aren't serviced
+        mobile_time_update(adapter);
+        group_relay_expire(group, adapter);
+
+        if (adapter->group.pending || group_member_busy(adapter) ||
+                group_member_wait(group, adapter) == 0) {
+            adapter->group.pending = false;
+            mobile_loop(adapter);
+        }
+
+        // Whatever is still due couldn't be done yet, try again later
+        int wait = group_member_wait(group, adapter);
+        if (wait == 0) wait = MOBILE_GROUP_INTERVAL_MS;
+        if (wait >= 0 && (next < 0 || wait < next)) next = wait;
+    }
+
+    return next;
+}
+
+void mobile_group_add(struct mobile_group *group, struct mobile_adapter *adapter)
+{
+    if (adapter->group.group) return;
+
+    adapter->group.group = group;
+    adapter->group.next = group->first;
+    group->first = adapter;
+
+    // Service the adapter at least once
+    adapter->group.pending = false;
+    mobile_group_notify(adapter);
+}
+
+void mobile_group_remove(struct mobile_group *group, struct mobile_adapter *adapter)
+{
+    struct mobile_adapter **link = &group->first;
+    while (*link && *link != adapter) link = &(*link)->group.next;
+    if (!*link) return;
+
+    *link = adapter->group.next;
+    group->relay_taken -= adapter->group.relay_permits;
+    mobile_group_member_init(adapter);
+}
+
+void mobile_group_init(struct mobile_group *group, mobile_func_group_wake func, void *user)
+{
+    group->first = NULL;
+    group->user = user;
+    group->wake = func;
+    group->relay_limit = 0;
+    group->relay_window = 0;
+    group->relay_taken = 0;
+}
+
+void mobile_group_set_relay_limit(struct mobile_group *group, unsigned limit, unsigned window_ms)
+{
+    group->relay_limit = limit;
+    group->relay_window = window_ms;
+}
+
+const size_t mobile_group_sizeof PROGMEM = sizeof(struct mobile_group);
+
+#ifndef MOBILE_ENABLE_NOALLOC
+#include <stdlib.h>
+struct mobile_group *mobile_group_new(mobile_func_group_wake func, void *user)
+{
+    struct mobile_group *group = malloc(sizeof(struct mobile_group));
+    mobile_group_init(group, func, user);
+    return group;
+}
+#endif
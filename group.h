@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mobile.h"
+#include "atomic.h"
+
+// Time between dispatches, while any adapter in the group is busy
+#define MOBILE_GROUP_INTERVAL_MS 50
+
+struct mobile_group {
+    struct mobile_adapter *first;
+    void *user;
+    mobile_func_group_wake wake;
+
+    // Relay connections that may be opened within every relay_window
+    //   milliseconds, and the amount of them held by adapters, see
+    //   mobile_group_relay_permit()
+    unsigned relay_limit;
+    unsigned relay_window;
+    unsigned relay_taken;
+};
+
+struct mobile_adapter_group {
+    struct mobile_group *group;
+    struct mobile_adapter *next;
+
+    // Set by mobile_group_notify(), possibly from the serial thread
+    _Atomic volatile bool pending;
+
+    // Amount of relay permits held by the adapter, and when it took the
+    //   newest of them
+    unsigned relay_permits;
+    uint32_t relay_permit_time;
+};
+
+void mobile_group_member_init(struct mobile_adapter *adapter);
+bool mobile_group_relay_permit(struct mobile_adapter *adapter);
+
+#undef _Atomic  // "atomic.h"
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "metrics.h"
+
+#include <string.h>
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Metrics
+// When MOBILE_ENABLE_METRICS is set, adapters may be attached to a slot of a
+//   struct mobile_metrics, and count everything the session summary counts
+//   into it, for as long as they're attached. Every counter is also added to
+//   the totals, which are shared by all adapters attached to the same metrics,
+//   possibly running in different threads. Because of this, and because the
+//   serial thread counts the serial errors, every counter is updated with an
+//   atomic add. Ordering doesn't matter to the readers, so it's relaxed.
+
+void mobile_metrics_member_init(struct mobile_adapter *adapter)
+{
+#ifdef MOBILE_ENABLE_METRICS
+    struct mobile_adapter_metrics *s = &adapter->metrics;
+
+    s->metrics = NULL;
+    s->slot = NULL;
+#else
+    (void)adapter;
+#endif
+}
+
+#ifdef MOBILE_ENABLE_METRICS
+static_assert(sizeof(struct mobile_metrics_slot) % sizeof(uint32_t) == 0,
+    "Metrics slots must only contain counters");
+static_assert(sizeof(struct mobile_metrics_slot) <= UINT16_MAX,
+    "Metrics slots must fit in the slot_size field");
+
+// The counters are plain integers in the public header, so they can't be
+//   declared _Atomic. Compilers without the GNU builtins (MSVC) fall back to a
+//   plain add, which may miss counts when several threads share the metrics.
+static void counter_add(uint32_t *counter, uint32_t value)
+{
+#ifdef __GNUC__
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+#else
+    *(volatile uint32_t *)counter += value;
+#endif
+}
+
+static void counter_store(uint32_t *counter, uint32_t value)
+{
+#ifdef __GNUC__
+    __atomic_store_n(counter, value, __ATOMIC_RELEASE);
+#else
+    *(volatile uint32_t *)counter = value;
+#endif
+}
+
+static struct mobile_metrics_slot *metrics_slot(struct mobile_metrics *metrics, unsigned slot)
+{
+    return (struct mobile_metrics_slot *)((char *)(metrics + 1) +
+        (size_t)metrics->slot_size * slot);
+}
+
+// Add <value> to the counter at <offset> of both the slot and the totals
+void mobile_metrics_add_at(struct mobile_adapter *adapter, size_t offset, uint32_t value)
+{
+    struct mobile_adapter_metrics *s = &adapter->metrics;
+
+    if (!s->metrics) return;
+    counter_add((uint32_t *)((char *)&s->metrics->total + offset), value);
+    counter_add((uint32_t *)((char *)s->slot + offset), value);
+}
+
+// Count a command the same way as mobile_summary_command()
+void mobile_metrics_command(struct mobile_adapter *adapter, const struct mobile_command_record *command)
+{
+    if (!adapter->metrics.metrics) return;
+
+    unsigned bucket = mobile_latency_bucket(command->ms);
+    mobile_metrics_add_at(adapter,
+        offsetof(struct mobile_metrics_slot, latency_command) +
+        sizeof(uint32_t) * bucket, 1);
+    if (command->command < MOBILE_SUMMARY_MAX_COMMANDS) {
+        mobile_metrics_add_at(adapter,
+            offsetof(struct mobile_metrics_slot, commands) +
+            sizeof(uint32_t) * command->command, 1);
+    }
+
+    if (command->error) {
+        mobile_metrics_add(adapter, command_errors, 1);
+        if (command->command == MOBILE_COMMAND_DNS_REQUEST) {
+            mobile_metrics_add(adapter, dns_misses, 1);
+        }
+        return;
+    }
+
+    switch (command->command) {
+    case MOBILE_COMMAND_TEL:
+    case MOBILE_COMMAND_TCP_CONNECT:
+        mobile_metrics_add_at(adapter,
+            offsetof(struct mobile_metrics_slot, latency_connect) +
+            sizeof(uint32_t) * bucket, 1);
+        break;
+
+    case MOBILE_COMMAND_DNS_REQUEST:
+        mobile_metrics_add(adapter, dns_hits, 1);
+        break;
+
+    case MOBILE_COMMAND_DATA:
+        if (command->conn >= MOBILE_MAX_CONNECTIONS) break;
+        mobile_metrics_add_at(adapter,
+            offsetof(struct mobile_metrics_slot, bytes_sent) +
+            sizeof(uint32_t) * command->conn, command->sent);
+        mobile_metrics_add_at(adapter,
+            offsetof(struct mobile_metrics_slot, bytes_recv) +
+            sizeof(uint32_t) * command->conn, command->recv);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void mobile_metrics_attach(struct mobile_adapter *adapter, struct mobile_metrics *metrics, unsigned slot)
+{
+    struct mobile_adapter_metrics *s = &adapter->metrics;
+
+    s->metrics = NULL;
+    s->slot = NULL;
+    if (!metrics || slot >= metrics->slot_count) return;
+
+    struct mobile_metrics_slot *p = metrics_slot(metrics, slot);
+    uint32_t *counter = (uint32_t *)p;
+    for (size_t i = 1; i < metrics->slot_size / sizeof(uint32_t); i++) {
+        counter[i] = 0;
+    }
+    counter_add(&p->generation, 1);
+    counter_add(&metrics->total.generation, 1);
+
+    s->slot = p;
+    s->metrics = metrics;
+}
+
+void mobile_metrics_init(struct mobile_metrics *metrics, unsigned slots)
+{
+    metrics->magic = 0;
+    memset(&metrics->total, 0, sizeof(metrics->total));
+    metrics->version = MOBILE_METRICS_VERSION;
+    metrics->slot_size = sizeof(struct mobile_metrics_slot);
+    metrics->slot_count = slots;
+    memset(metrics + 1, 0, sizeof(struct mobile_metrics_slot) * slots);
+    counter_store(&metrics->magic, MOBILE_METRICS_MAGIC);
+}
+#endif
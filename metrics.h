@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mobile.h"
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
+struct mobile_command_record;
+
+struct mobile_adapter_metrics {
+#ifdef MOBILE_ENABLE_METRICS
+    struct mobile_metrics *metrics;
+    struct mobile_metrics_slot *slot;
+#endif
+};
+
+void mobile_metrics_member_init(struct mobile_adapter *adapter);
+
+#ifdef MOBILE_ENABLE_METRICS
+void mobile_metrics_add_at(struct mobile_adapter *adapter, size_t offset, uint32_t value);
+void mobile_metrics_command(struct mobile_adapter *adapter, const struct mobile_command_record *command);
+
+// Add <value> to <counter> of struct mobile_metrics_slot
+#define mobile_metrics_add(adapter, counter, value) \
+    mobile_metrics_add_at(adapter, \
+        offsetof(struct mobile_metrics_slot, counter), value)
+#endif
@@ -12,7 +12,8 @@
 #include <mobile_config.h>
 #endif
 
-static const int number_fetch_conn = 0;
+static_assert(MOBILE_NUMBER_FETCH_CONN < MOBILE_MAX_CONNECTIONS,
+    "MOBILE_MAX_CONNECTIONS isn't big enough!");
 
 static void mobile_global_init(struct mobile_adapter *adapter)
 {
@@ -20,7 +21,65 @@ static void mobile_global_init(struct mobile_adapter *adapter)
     adapter->global.active = false;
     adapter->global.packet_parsed = false;
     adapter->global.number_fetch_active = false;
-    adapter->global.number_fetch_retries = 3;
+    adapter->global.connect_data_checked = false;
+    adapter->global.connect_data = false;
+    adapter->global.draining = false;
+    adapter->global.number_fetch_retries = MOBILE_NUMBER_FETCH_RETRIES;
+    adapter->global.number_fetch_delay = 0;
+    adapter->global.jitter = 1;
+}
+
+// Seed the pseudo-random generator with what tells adapters apart: their
+//   address in memory, and their relay token.
+static void jitter_seed(struct mobile_adapter *adapter)
+{
+    // FNV-1a
+    uint32_t seed = 2166136261u;
+    uintptr_t addr = (uintptr_t)adapter;
+    for (unsigned i = 0; i < sizeof(addr); i++) {
+        seed = (seed ^ (unsigned char)addr) * 16777619u;
+        addr >>= 8;
+    }
+    if (adapter->config.relay_token_init) {
+        for (unsigned i = 0; i < MOBILE_RELAY_TOKEN_SIZE; i++) {
+            seed = (seed ^ adapter->config.relay_token[i]) * 16777619u;
+        }
+    }
+    adapter->global.jitter = seed ? seed : 1;
+}
+
+// Returns: a pseudo-random number from 0 to <max>, inclusive
+static uint32_t jitter_get(struct mobile_adapter *adapter, uint32_t max)
+{
+    // xorshift32
+    uint32_t x = adapter->global.jitter;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    adapter->global.jitter = x;
+
+    if (max == UINT32_MAX) return x;
+    return x % (max + 1);
+}
+
+// Connect a socket, sending the first data along with the connection request
+//   if the host supports it.
+// Returns: -1 on error, 0 if processing, 1 if connected and the data was sent,
+//   2 if connected without sending the data
+int mobile_sock_connect_data(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr, const void *data, unsigned size)
+{
+    struct mobile_adapter_global *s = &adapter->global;
+
+    if (!s->connect_data_checked || s->connect_data) {
+        int rc = mobile_cb_sock_connect_data(adapter, conn, addr, data, size);
+        s->connect_data_checked = true;
+        s->connect_data = rc != -2;
+        if (rc != -2) return rc;
+    }
+
+    int rc = mobile_cb_sock_connect(adapter, conn, addr);
+    if (rc > 0 && size) return 2;
+    return rc;
 }
 
 static void debug_prefix(struct mobile_adapter *adapter)
@@ -43,14 +102,30 @@ static void mobile_reset(struct mobile_adapter *adapter)
     adapter->global.packet_parsed = false;
 }
 
+#ifdef MOBILE_ENABLE_POOL
+// Return the buffers to the pool, unless they're still needed
+static void buffer_release_idle(struct mobile_adapter *adapter)
+{
+    if (!adapter->buffer) return;
+    if (adapter->commands.session_started) return;
+    if (adapter->global.number_fetch_active) return;
+
+    enum mobile_serial_state state = adapter->serial.state;
+    if (state != MOBILE_SERIAL_INIT && state != MOBILE_SERIAL_WAITING) return;
+
+    mobile_buffer_release(adapter);
+    adapter->serial.state = MOBILE_SERIAL_INIT;
+}
+#endif
+
 static struct mobile_packet packet_parse(struct mobile_adapter *adapter)
 {
     struct mobile_adapter_serial *s = &adapter->serial;
-    struct mobile_buffer_serial *b = &adapter->buffer.serial;
+    struct mobile_framing *f = &adapter->buffer->serial.frame;
 
     struct mobile_packet packet = {
-        .command = b->header[0],
-        .length = b->header[3],
+        .command = f->header[0],
+        .length = f->header[3],
         .data = s->buffer
     };
 
@@ -60,12 +135,12 @@ static struct mobile_packet packet_parse(struct mobile_adapter *adapter)
 static void packet_create(struct mobile_adapter *adapter, struct mobile_packet packet)
 {
     struct mobile_adapter_serial *s = &adapter->serial;
-    struct mobile_buffer_serial *b = &adapter->buffer.serial;
+    struct mobile_framing *f = &adapter->buffer->serial.frame;
 
-    b->header[0] = packet.command | 0x80;
-    b->header[1] = 0;
-    b->header[2] = 0;
-    b->header[3] = packet.length;
+    f->header[0] = packet.command | 0x80;
+    f->header[1] = 0;
+    f->header[2] = 0;
+    f->header[3] = packet.length;
     memmove(s->buffer, packet.data, packet.length);
 
     // Align the packet in 32bit mode
@@ -74,23 +149,84 @@ static void packet_create(struct mobile_adapter *adapter, struct mobile_packet p
     }
 
     unsigned checksum = 0;
-    for (unsigned i = 0; i < sizeof(b->header); i++) checksum += b->header[i];
+    for (unsigned i = 0; i < sizeof(f->header); i++) checksum += f->header[i];
     for (unsigned i = 0; i < packet.length; i++) checksum += s->buffer[i];
-    b->footer[0] = checksum >> 8;
-    b->footer[1] = checksum;
+    f->footer[0] = checksum >> 8;
+    f->footer[1] = checksum;
+}
+
+#if defined(MOBILE_ENABLE_SUMMARY) || defined(MOBILE_ENABLE_METRICS)
+// Latency histogram bucket of <ms>, see MOBILE_SUMMARY_LATENCY_BUCKETS
+unsigned mobile_latency_bucket(uint32_t ms)
+{
+    unsigned bucket = 0;
+    while (ms && bucket < MOBILE_SUMMARY_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
 }
 
+// Remember the parts of a received packet that are overwritten by its reply
+static void command_record_begin(struct mobile_adapter *adapter, const struct mobile_packet *packet)
+{
+    struct mobile_command_record *r = &adapter->global.command;
+
+    r->start = mobile_time_now(adapter);
+    r->ms = 0;
+    r->command = packet->command;
+    r->conn = 0;
+    r->sent = 0;
+    r->recv = 0;
+    r->error = false;
+
+    if (packet->command == MOBILE_COMMAND_DATA && packet->length >= 1) {
+        // Calls always use connection 0, see commands.c:command_data()
+        if (adapter->commands.state == MOBILE_CONNECTION_INTERNET) {
+            r->conn = packet->data[0];
+        }
+        r->sent = packet->length - 1;
+    }
+}
+
+// Complete the record with the reply, and hand it to everything counting it
+static void command_record_end(struct mobile_adapter *adapter, const struct mobile_packet *packet)
+{
+    struct mobile_command_record *r = &adapter->global.command;
+
+    // Only count what happens within a session
+    if (!adapter->commands.session_started) return;
+
+    r->ms = mobile_time_now(adapter) - r->start;
+    r->error = packet->command == MOBILE_COMMAND_ERROR;
+    if (r->command == MOBILE_COMMAND_DATA && !r->error &&
+            packet->length >= 1) {
+        r->recv = packet->length - 1;
+    }
+
+#ifdef MOBILE_ENABLE_SUMMARY
+    mobile_summary_command(adapter, r);
+#endif
+#ifdef MOBILE_ENABLE_METRICS
+    mobile_metrics_command(adapter, r);
+#endif
+}
+#endif
+
 static bool command_handle(struct mobile_adapter *adapter)
 {
     struct mobile_adapter_global *s = &adapter->global;
 
-    struct mobile_packet *packet = &adapter->buffer.commands.packet;
+    struct mobile_packet *packet = &adapter->buffer->commands.packet;
 
     // If the packet hasn't been parsed yet, parse and store it
     if (!s->packet_parsed) {
         *packet = packet_parse(adapter);
         mobile_debug_command(adapter, packet, false);
-        adapter->buffer.commands.processing = 0;
+#if defined(MOBILE_ENABLE_SUMMARY) || defined(MOBILE_ENABLE_METRICS)
+        command_record_begin(adapter, packet);
+#endif
+        adapter->buffer->commands.processing = 0;
         s->packet_parsed = true;
     }
 
@@ -99,6 +235,9 @@ static bool command_handle(struct mobile_adapter *adapter)
     // If there's a packet to be sent, write it out and return true
     if (send) {
         mobile_debug_command(adapter, send, true);
+#if defined(MOBILE_ENABLE_SUMMARY) || defined(MOBILE_ENABLE_METRICS)
+        command_record_end(adapter, send);
+#endif
         packet_create(adapter, *send);
         s->packet_parsed = false;
         return true;
@@ -110,7 +249,7 @@ static bool command_handle(struct mobile_adapter *adapter)
 void mobile_number_fetch_cancel(struct mobile_adapter *adapter)
 {
     if (adapter->global.number_fetch_active) {
-        mobile_cb_sock_close(adapter, number_fetch_conn);
+        mobile_cb_sock_close(adapter, MOBILE_NUMBER_FETCH_CONN);
         adapter->global.number_fetch_active = false;
     }
 }
@@ -123,12 +262,55 @@ void mobile_number_fetch_reset(struct mobile_adapter *adapter)
         mobile_cb_update_number(adapter, MOBILE_NUMBER_USER, NULL);
     }
 
-    adapter->global.number_fetch_retries = 3;
+    adapter->global.number_fetch_retries = MOBILE_NUMBER_FETCH_RETRIES;
+    adapter->global.number_fetch_delay = 0;
+}
+
+// Schedule the next attempt at fetching the number, after a failed one.
+// The delay doubles with every failure, and a random point in its upper half
+//   is picked, so that adapters that failed at the same time (e.g. because the
+//   relay restarted) don't all come back at once.
+static void number_fetch_backoff(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_global *s = &adapter->global;
+
+    // Nothing left to retry, or the number was fetched
+    if (!s->number_fetch_retries) return;
+
+    unsigned shift = MOBILE_NUMBER_FETCH_RETRIES - s->number_fetch_retries;
+    if (shift) shift--;
+
+    // Timers only have to keep track of 60 seconds
+    uint32_t delay =
+        (uint32_t)adapter->time.timeouts[MOBILE_TIMEOUT_RELAY_BACKOFF] << shift;
+    if (delay > 60000) delay = 60000;
+    mobile_time_latch(adapter, MOBILE_TIMER_NUMBER_FETCH);
+    s->number_fetch_delay = delay - jitter_get(adapter, delay / 2);
+}
+
+static bool number_fetch_ready(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_global *s = &adapter->global;
+
+    if (!s->number_fetch_delay) return true;
+    return mobile_time_check_ms(adapter, MOBILE_TIMER_NUMBER_FETCH,
+        s->number_fetch_delay);
 }
 
 static void number_fetch_handle(struct mobile_adapter *adapter)
 {
     if (!adapter->global.number_fetch_active) {
+#ifdef MOBILE_ENABLE_POOL
+        if (!mobile_buffer_lease(adapter)) return;
+#endif
+        // Wait for the group to allow another relay connection
+        if (!mobile_group_relay_permit(adapter)) {
+#ifdef MOBILE_ENABLE_POOL
+            buffer_release_idle(adapter);
+#endif
+            return;
+        }
+
         debug_prefix(adapter);
         mobile_debug_print(adapter, "Checking mobile number...");
         mobile_debug_endl(adapter);
@@ -136,25 +318,34 @@ static void number_fetch_handle(struct mobile_adapter *adapter)
         if (adapter->global.number_fetch_retries) {
             adapter->global.number_fetch_retries--;
         }
-        mobile_relay_init(adapter);
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_COMMAND);
-        mobile_cb_sock_open(adapter, number_fetch_conn, MOBILE_SOCKTYPE_TCP,
-            adapter->config.relay.type, 0);
+        mobile_relay_init(adapter, MOBILE_NUMBER_FETCH_CONN);
+        mobile_time_latch(adapter, MOBILE_TIMER_NUMBER_FETCH);
+        mobile_cb_sock_open(adapter, MOBILE_NUMBER_FETCH_CONN,
+            MOBILE_SOCKTYPE_TCP, adapter->config.relay.type, 0);
         adapter->global.number_fetch_active = true;
-    } else if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_COMMAND, 3000)) {
+    } else if (mobile_time_check_timeout(adapter, MOBILE_TIMER_NUMBER_FETCH,
+            MOBILE_TIMEOUT_NUMBER_FETCH)) {
         debug_prefix(adapter);
         mobile_debug_print(adapter, PSTR("Timeout"));
         mobile_debug_endl(adapter);
 
-        mobile_cb_sock_close(adapter, number_fetch_conn);
+        mobile_cb_sock_close(adapter, MOBILE_NUMBER_FETCH_CONN);
         adapter->global.number_fetch_active = false;
+        number_fetch_backoff(adapter);
+#ifdef MOBILE_ENABLE_POOL
+        buffer_release_idle(adapter);
+#endif
         return;
     }
 
-    if (mobile_relay_proc_init_number(adapter, number_fetch_conn,
+    if (mobile_relay_proc_init_number(adapter, MOBILE_NUMBER_FETCH_CONN,
             &adapter->config.relay) != 0) {
-        mobile_cb_sock_close(adapter, number_fetch_conn);
+        mobile_cb_sock_close(adapter, MOBILE_NUMBER_FETCH_CONN);
         adapter->global.number_fetch_active = false;
+        number_fetch_backoff(adapter);
+#ifdef MOBILE_ENABLE_POOL
+        buffer_release_idle(adapter);
+#endif
     }
 }
 
@@ -164,19 +355,23 @@ enum mobile_action mobile_actions_get(struct mobile_adapter *adapter)
 
     enum mobile_action actions = MOBILE_ACTION_NONE;
 
+    // Collect the time passed along with mobile_transfer_cycles()
+    mobile_time_update(adapter);
+
     // If the serial has been active at all, latch the timer
     if (adapter->serial.active) {
         // NOTE: Race condition possible, but not critical.
         adapter->serial.active = false;
         adapter->global.active = true;
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_SERIAL);
+        mobile_time_latch(adapter, MOBILE_TIMER_SERIAL);
     }
 
     // If the adapter is stuck waiting, with no signal from the game,
     //   put it out of its misery.
     // Timeout has been verified on hardware.
     if (adapter->commands.session_started &&
-            mobile_cb_time_check_ms(adapter, MOBILE_TIMER_SERIAL, 3000)) {
+            mobile_time_check_timeout(adapter, MOBILE_TIMER_SERIAL,
+                MOBILE_TIMEOUT_SERIAL_IDLE)) {
         actions |= MOBILE_ACTION_DROP_CONNECTION;
     }
 
@@ -184,7 +379,8 @@ enum mobile_action mobile_actions_get(struct mobile_adapter *adapter)
     //   ended, perform a reset.
     if (adapter->global.active &&
             !adapter->commands.session_started &&
-            mobile_cb_time_check_ms(adapter, MOBILE_TIMER_SERIAL, 3000)) {
+            mobile_time_check_timeout(adapter, MOBILE_TIMER_SERIAL,
+                MOBILE_TIMEOUT_SERIAL_IDLE)) {
         actions |= MOBILE_ACTION_RESET;
     }
 
@@ -197,7 +393,8 @@ enum mobile_action mobile_actions_get(struct mobile_adapter *adapter)
     //   in an attempt to synchronize.
     if (!adapter->global.active &&
             !adapter->commands.session_started &&
-            mobile_cb_time_check_ms(adapter, MOBILE_TIMER_SERIAL, 500)) {
+            mobile_time_check_timeout(adapter, MOBILE_TIMER_SERIAL,
+                MOBILE_TIMEOUT_SERIAL_RESYNC)) {
         actions |= MOBILE_ACTION_RESET_SERIAL;
     }
 
@@ -212,11 +409,19 @@ enum mobile_action mobile_actions_get(struct mobile_adapter *adapter)
         actions |= MOBILE_ACTION_WRITE_CONFIG;
     }
 
+    // Give up on a timed out connection the game hasn't retried
+    if (mobile_commands_parked_expired(adapter)) {
+        actions |= MOBILE_ACTION_EXPIRE_PARKED;
+    }
+
     // When we have time for it, attempt to fetch the user's number
+    //   (but don't start one while draining, see mobile_drain())
     if (adapter->global.number_fetch_active || (
                 !adapter->global.active &&
+                !adapter->global.draining &&
                 adapter->global.number_fetch_retries &&
-                adapter->config.relay.type != MOBILE_ADDRTYPE_NONE)) {
+                adapter->config.relay.type != MOBILE_ADDRTYPE_NONE &&
+                number_fetch_ready(adapter))) {
         actions |= MOBILE_ACTION_INIT_NUMBER;
     }
 
@@ -235,7 +440,10 @@ void mobile_actions_process(struct mobile_adapter *adapter, enum mobile_action a
         mobile_debug_endl(adapter);
 
         mobile_reset(adapter);
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_SERIAL);
+#ifdef MOBILE_ENABLE_POOL
+        buffer_release_idle(adapter);
+#endif
+        mobile_time_latch(adapter, MOBILE_TIMER_SERIAL);
         mobile_cb_serial_enable(adapter, adapter->serial.mode_32bit);
         return;
     }
@@ -249,8 +457,11 @@ void mobile_actions_process(struct mobile_adapter *adapter, enum mobile_action a
         adapter->global.active = false;
         adapter->commands.mode_32bit = false;
         mode_32bit_change(adapter);
+#ifdef MOBILE_ENABLE_POOL
+        buffer_release_idle(adapter);
+#endif
 
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_SERIAL);
+        mobile_time_latch(adapter, MOBILE_TIMER_SERIAL);
         mobile_cb_serial_enable(adapter, adapter->serial.mode_32bit);
         return;
     }
@@ -268,7 +479,10 @@ void mobile_actions_process(struct mobile_adapter *adapter, enum mobile_action a
     // Reset the serial's current bit state in an attempt to synchronize
     if (actions & MOBILE_ACTION_RESET_SERIAL) {
         mobile_cb_serial_disable(adapter);
-        mobile_cb_time_latch(adapter, MOBILE_TIMER_SERIAL);
+#ifdef MOBILE_ENABLE_POOL
+        buffer_release_idle(adapter);
+#endif
+        mobile_time_latch(adapter, MOBILE_TIMER_SERIAL);
         mobile_cb_serial_enable(adapter, adapter->serial.mode_32bit);
         return;
     }
@@ -289,6 +503,12 @@ void mobile_actions_process(struct mobile_adapter *adapter, enum mobile_action a
         return;
     }
 
+    // Close the parked connection once its grace period is over
+    if (actions & MOBILE_ACTION_EXPIRE_PARKED) {
+        mobile_commands_parked_expire(adapter);
+        return;
+    }
+
     // Use free time to initialize the phone number
     if (actions & MOBILE_ACTION_INIT_NUMBER) {
         number_fetch_handle(adapter);
@@ -301,9 +521,24 @@ void mobile_loop(struct mobile_adapter *adapter)
     mobile_actions_process(adapter, mobile_actions_get(adapter));
 }
 
-uint8_t mobile_transfer(struct mobile_adapter *adapter, uint8_t c)
+void mobile_loop_cycles(struct mobile_adapter *adapter, uint32_t cycles)
 {
+    mobile_time_advance(adapter, cycles);
+    mobile_loop(adapter);
+}
+
+// Groups only service adapters that have something to do, let them know
+//   once the game starts exchanging data
+static void transfer_active(struct mobile_adapter *adapter)
+{
+    if (adapter->serial.active) return;
     adapter->serial.active = true;
+    mobile_group_notify(adapter);
+}
+
+uint8_t mobile_transfer(struct mobile_adapter *adapter, uint8_t c)
+{
+    transfer_active(adapter);
 
     // Nothing should be done while switching the mode_32bit
     // This should be picked up by mobile_actions_get/mobile_actions_process
@@ -317,7 +552,7 @@ uint8_t mobile_transfer(struct mobile_adapter *adapter, uint8_t c)
 
 uint32_t mobile_transfer_32bit(struct mobile_adapter *adapter, uint32_t c)
 {
-    adapter->serial.active = true;
+    transfer_active(adapter);
 
     // Nothing should be done while switching the mode_32bit
     // This should be picked up by mobile_actions_get/mobile_actions_process
@@ -329,14 +564,48 @@ uint32_t mobile_transfer_32bit(struct mobile_adapter *adapter, uint32_t c)
     return mobile_serial_transfer_32bit(adapter, c);
 }
 
+uint8_t mobile_transfer_cycles(struct mobile_adapter *adapter, uint8_t c, uint32_t cycles)
+{
+    mobile_time_advance_serial(adapter, cycles);
+    return mobile_transfer(adapter, c);
+}
+
+uint32_t mobile_transfer_32bit_cycles(struct mobile_adapter *adapter, uint32_t c, uint32_t cycles)
+{
+    mobile_time_advance_serial(adapter, cycles);
+    return mobile_transfer_32bit(adapter, c);
+}
+
+unsigned mobile_transfer_predict(struct mobile_adapter *adapter, unsigned char *data, unsigned size)
+{
+    // Nothing can be predicted while switching the mode_32bit
+    if (adapter->serial.state == MOBILE_SERIAL_WAITING &&
+            adapter->serial.mode_32bit != adapter->commands.mode_32bit) {
+        return 0;
+    }
+
+    unsigned count = mobile_serial_predict(adapter, data, size);
+
+    // Only whole words may be predicted in 32bit mode
+    if (adapter->serial.mode_32bit) count -= count % 4;
+    return count;
+}
+
 void mobile_start(struct mobile_adapter *adapter)
 {
     if (adapter->global.start) return;
     adapter->global.start = true;
 
     mobile_config_load(adapter);
-    mobile_cb_time_latch(adapter, MOBILE_TIMER_SERIAL);
+
+    // Spread out the first number fetch of adapters started together
+    jitter_seed(adapter);
+    mobile_time_latch(adapter, MOBILE_TIMER_NUMBER_FETCH);
+    adapter->global.number_fetch_delay = jitter_get(adapter,
+        adapter->time.timeouts[MOBILE_TIMEOUT_RELAY_STAGGER]);
+    mobile_time_latch(adapter, MOBILE_TIMER_SERIAL);
     mobile_cb_serial_enable(adapter, adapter->serial.mode_32bit);
+    mobile_group_notify(adapter);
 }
 
 void mobile_stop(struct mobile_adapter *adapter)
@@ -353,20 +622,44 @@ void mobile_stop(struct mobile_adapter *adapter)
     }
 
     mobile_reset(adapter);
+    mobile_number_fetch_cancel(adapter);
+#ifdef MOBILE_ENABLE_POOL
+    mobile_buffer_release(adapter);
+#endif
     mobile_config_save(adapter);
 }
 
+void mobile_drain(struct mobile_adapter *adapter, bool enable)
+{
+    adapter->global.draining = enable;
+}
+
+bool mobile_drained(struct mobile_adapter *adapter)
+{
+    if (!adapter->global.draining) return false;
+    return !adapter->commands.session_started &&
+        !adapter->global.number_fetch_active;
+}
+
 void mobile_init(struct mobile_adapter *adapter, void *user)
 {
     adapter->user = user;
 
     mobile_global_init(adapter);
     mobile_callback_init(adapter);
+    mobile_time_init(adapter);
+    mobile_profile_init(adapter);
     mobile_config_init(adapter);
     mobile_debug_init(adapter);
     mobile_commands_init(adapter);
     mobile_serial_init(adapter);
     mobile_dns_init(adapter);
+    mobile_buffer_init(adapter);
+    mobile_group_member_init(adapter);
+    mobile_summary_init(adapter);
+    mobile_metrics_member_init(adapter);
+    mobile_relay_redirect_clear(adapter);
+    mobile_relay_number_forget(adapter);
 }
 
 const size_t mobile_sizeof PROGMEM = sizeof(struct mobile_adapter);
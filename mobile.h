@@ -14,10 +14,17 @@ extern "C" {
 #include <stdbool.h>
 
 struct mobile_adapter;
+struct mobile_sniffer;
+struct mobile_bridge;
+struct mobile_bgb;
+struct mobile_tuner;
+struct mobile_pool;
+struct mobile_group;
+struct mobile_session_summary;
 
 // Limits any user of this library should abide by
-#define MOBILE_MAX_CONNECTIONS 2
-#define MOBILE_MAX_TIMERS 4
+#define MOBILE_MAX_CONNECTIONS 3
+#define MOBILE_MAX_TIMERS 5
 #define MOBILE_MAX_TRANSFER_SIZE 0xFE  // MOBILE_MAX_DATA_SIZE - 1
 #define MOBILE_MAX_NUMBER_SIZE 0x20  // Allowed phone number length: 7-16
 #define MOBILE_CONFIG_SIZE 0x200
@@ -53,7 +60,8 @@ enum mobile_action {
     MOBILE_ACTION_RESET_SERIAL = 1 << 3,
     MOBILE_ACTION_CHANGE_32BIT_MODE = 1 << 4,
     MOBILE_ACTION_WRITE_CONFIG = 1 << 5,
-    MOBILE_ACTION_INIT_NUMBER = 1 << 6
+    MOBILE_ACTION_INIT_NUMBER = 1 << 6,
+    MOBILE_ACTION_EXPIRE_PARKED = 1 << 7
 };
 
 enum mobile_socktype {
@@ -182,6 +190,10 @@ void mobile_def_config_write(struct mobile_adapter *adapter, mobile_func_config_
 // track of at least 60 seconds, with millisecond precision, preferably with
 // little to no time skew.
 //
+// Emulators may instead let libmobile keep track of time by itself, using
+// mobile_time_set_rate(). In that case, neither this function nor
+// mobile_func_time_check_ms() will ever be called.
+//
 // This function will "latch" the current time to the specified timer, by
 // storing the current value so it may later be compared.
 //
@@ -220,6 +232,8 @@ void mobile_def_time_check_ms(struct mobile_adapter *adapter, mobile_func_time_c
 // SO_REUSEADDR option must be set, in order to avoid not being able to bind an
 // otherwise unused port. The <conn> parameter indicates the selected socket
 // that should be opened, of which there are at most MOBILE_MAX_CONNECTIONS.
+// The last one is used to retrieve the adapter's number from the relay server,
+// and may be in use alongside the others.
 //
 // Since non-blocking operations will be required for different socket-related
 // functions, enabling non-blocking mode on this socket might be necessary.
@@ -266,6 +280,13 @@ void mobile_def_sock_close(struct mobile_adapter *adapter, mobile_func_sock_clos
 // Connecting a socket to an <addr> of a different type as the socket should
 // produce an error, libmobile shall never do this.
 //
+// The library doesn't interpret the data exchanged by the game, so the
+// implementation is free to not connect anywhere at all, and serve the
+// connection locally instead. For example, connections to the mail servers
+// (SMTP on port 25, POP3 on port 110) may be answered from a local spool,
+// which forwards the mail and fetches the mailboxes in the background,
+// instead of making the game wait on the real servers.
+//
 // Returns: 1 on success, 0 if connect is in progress, -1 on error
 // Parameters:
 // - conn: Socket number
@@ -397,6 +418,58 @@ typedef void (*mobile_func_update_number)(void *user, enum mobile_number type, c
 void mobile_impl_update_number(void *user, enum mobile_number type, const char *number);
 void mobile_def_update_number(struct mobile_adapter *adapter, mobile_func_update_number func);
 
+// mobile_func_sock_connect_data - Connect a socket, sending data early
+//
+// Behaves like mobile_func_sock_connect(), but additionally sends <data>
+// along with the connection request, for example through TCP Fast Open, saving
+// a round trip before the first data reaches the remote. If <size> is 0, this
+// function must behave exactly like mobile_func_sock_connect().
+//
+// The data is only considered sent once the connection succeeds, and the same
+// data will be passed again on every call until then. Upon success, all of the
+// data must have been sent or queued for sending.
+//
+// The default implementation returns -2, in which case libmobile falls back
+// to mobile_func_sock_connect() and mobile_func_sock_send(). It's currently
+// only used by the relay handshake, as the connections requested by the game
+// don't know their first data yet.
+//
+// Returns: 1 on success, 0 if connect is in progress, -1 on error,
+//          -2 if not supported
+// Parameters:
+// - conn: Socket number
+// - addr: Address to connect to
+// - data: Data to be sent
+// - size: Size of data to be sent
+typedef int (*mobile_func_sock_connect_data)(void *user, unsigned conn, const struct mobile_addr *addr, const void *data, unsigned size);
+int mobile_impl_sock_connect_data(void *user, unsigned conn, const struct mobile_addr *addr, const void *data, unsigned size);
+void mobile_def_sock_connect_data(struct mobile_adapter *adapter, mobile_func_sock_connect_data func);
+
+// mobile_func_profile_clock - Read a microsecond clock
+//
+// Only used when the library is built with MOBILE_ENABLE_PROFILER, to measure
+// how long each of the other callback functions takes to return. Returns the
+// current value of a monotonic clock, in microseconds. The value is allowed to
+// wrap around.
+//
+// Returns: Current time in microseconds
+typedef uint32_t (*mobile_func_profile_clock)(void *user);
+uint32_t mobile_impl_profile_clock(void *user);
+void mobile_def_profile_clock(struct mobile_adapter *adapter, mobile_func_profile_clock func);
+
+// mobile_func_session_summary - Receive the summary of a session
+//
+// Only used when the library is built with MOBILE_ENABLE_SUMMARY. Called once
+// at the end of every session, either when the game sends the END command, or
+// when the session is dropped. The <summary> is only valid until this function
+// returns. See struct mobile_session_summary for its contents.
+//
+// Parameters:
+// - summary: Summary of the session that just ended
+typedef void (*mobile_func_session_summary)(void *user, const struct mobile_session_summary *summary);
+void mobile_impl_session_summary(void *user, const struct mobile_session_summary *summary);
+void mobile_def_session_summary(struct mobile_adapter *adapter, mobile_func_session_summary func);
+
 void mobile_config_set_device(struct mobile_adapter *adapter, enum mobile_adapter_device device, bool unmetered);
 void mobile_config_get_device(struct mobile_adapter *adapter, enum mobile_adapter_device *device, bool *unmetered);
 void mobile_config_set_dns(struct mobile_adapter *adapter, const struct mobile_addr *dns1, const struct mobile_addr *dns2);
@@ -408,6 +481,243 @@ void mobile_config_get_relay(struct mobile_adapter *adapter, struct mobile_addr
 void mobile_config_set_relay_token(struct mobile_adapter *adapter, const unsigned char *token);
 bool mobile_config_get_relay_token(struct mobile_adapter *adapter, unsigned char *token);
 
+// mobile_time_set_rate - Derive the timers from the console's clock
+//
+// Instead of implementing mobile_func_time_latch() and
+// mobile_func_time_check_ms(), emulators may pass the amount of clock cycles
+// that have elapsed on the emulated console along with every call to
+// mobile_loop_cycles(), mobile_transfer_cycles() or
+// mobile_transfer_32bit_cycles(). All timers are then derived from this, which
+// keeps them exact regardless of the emulation speed, including fast-forward
+// and pausing.
+//
+// The cycles may be passed through any mix of these functions, but every
+// elapsed cycle must be passed exactly once. Passing the elapsed time in
+// microseconds, with a <rate> of 1000000, is valid as well.
+//
+// This function must be called after mobile_init(), and before
+// mobile_start(). A <rate> of 0 restores the default behavior of using the
+// timer callbacks.
+//
+// Parameters:
+// - adapter: Library state
+// - rate: Amount of clock cycles per second, or 0 to use the callbacks
+void mobile_time_set_rate(struct mobile_adapter *adapter, uint32_t rate);
+
+// Timeouts used by the library, in milliseconds
+enum mobile_timeout {
+    // Time without serial activity before a session is dropped (3000)
+    MOBILE_TIMEOUT_SERIAL_IDLE,
+    // Interval at which the serial is reset while idle, to resync (500)
+    MOBILE_TIMEOUT_SERIAL_RESYNC,
+    // Time to establish a call or TCP connection (60000)
+    MOBILE_TIMEOUT_CONNECT,
+    // Time to send the data of a single DATA command (10000)
+    MOBILE_TIMEOUT_SEND,
+    // Time to wait for incoming data when the game sends nothing (1000)
+    MOBILE_TIMEOUT_RECV,
+    // Time a single WAIT_CALL command waits for a call (1000)
+    MOBILE_TIMEOUT_WAIT_CALL,
+    // Time to wait for a DNS reply (3000)
+    MOBILE_TIMEOUT_DNS,
+    // Time to retrieve the adapter's number from the relay (3000)
+    MOBILE_TIMEOUT_NUMBER_FETCH,
+    // Time a timed out TCP connection attempt is kept for a retry (10000)
+    MOBILE_TIMEOUT_PARKED,
+    // Delay before retrying a failed number fetch, doubled for every further
+    //   retry, of which a random part of up to half is cut (1000)
+    MOBILE_TIMEOUT_RELAY_BACKOFF,
+    // Longest random delay of the first number fetch after mobile_start() (0)
+    MOBILE_TIMEOUT_RELAY_STAGGER,
+    MOBILE_MAX_TIMEOUTS
+};
+
+// mobile_time_set_timeout - Override the duration of a timeout
+// mobile_time_get_timeout - Retrieve the duration of a timeout
+//
+// The default values, listed in enum mobile_timeout, match the behavior of
+// the real adapter as closely as known, but some of them haven't been verified
+// with every game. These functions allow tuning them at runtime, e.g. to fit
+// the latency of the network in use. The values aren't stored in the
+// configuration, and are reset by mobile_init().
+//
+// Parameters:
+// - adapter: Library state
+// - timeout: Timeout to set or retrieve
+// - ms: Duration in milliseconds
+// Returns: Duration in milliseconds
+void mobile_time_set_timeout(struct mobile_adapter *adapter, enum mobile_timeout timeout, unsigned ms);
+unsigned mobile_time_get_timeout(struct mobile_adapter *adapter, enum mobile_timeout timeout);
+
+// mobile_debug_set_sampling - Only log a sample of the sessions
+//
+// Formatting the debug log for every packet is costly when running many
+// adapters at once. This function limits the packet logging to one out of
+// every <interval> sessions, where every session that isn't picked skips the
+// formatting entirely. Additionally, if a <threshold_ms> is given, any command
+// that takes at least this long to be processed will enable logging for the
+// remainder of its session, regardless of whether it was picked.
+//
+// Sessions are picked when the game sends the START command. Anything logged
+// outside of a session, e.g. by the number fetch, is always logged. By
+// default, an <interval> of 1 is used, which logs everything. An <interval>
+// of 0 doesn't pick any session, leaving only the <threshold_ms>.
+//
+// Parameters:
+// - adapter: Library state
+// - interval: Log one out of every <interval> sessions, 0 to log none
+// - threshold_ms: Command duration that enables logging, 0 to disable
+void mobile_debug_set_sampling(struct mobile_adapter *adapter, unsigned interval, unsigned threshold_ms);
+
+struct mobile_connection_stats {
+    uint32_t rtt_ms;  // Smoothed round trip time, 0 if not measured yet
+    uint32_t rtt_var_ms;  // Variation of the round trip time
+    uint32_t throughput;  // Bytes per second, over the last second or longer
+    uint32_t idle_ms;  // Time since data was last sent or received
+    uint32_t bytes_sent;  // Total data sent since the connection was opened
+    uint32_t bytes_recv;  // Total data received since the connection was opened
+};
+
+// mobile_connection_get_stats - Estimate the quality of a connection
+//
+// Retrieves the statistics of one of the connections opened by the game,
+// which can be used to judge the quality of the network. The round trip time
+// is measured between data being sent, and the next data being received on
+// the same connection, which makes it include the time the peer needs to
+// respond. In calls, this amounts to the time the game on the other end needs
+// to answer a packet.
+//
+// The library also uses this estimate to shorten the time it waits for
+// incoming data when the game sends an empty DATA command, down from
+// MOBILE_TIMEOUT_RECV, once the round trip time is known.
+//
+// This function must be called from the same thread as mobile_loop().
+//
+// Parameters:
+// - adapter: Library state
+// - conn: Connection ID, as used by the game (0 in calls)
+// - stats: Buffer to store the statistics in
+// Returns: false if the connection isn't open
+bool mobile_connection_get_stats(struct mobile_adapter *adapter, unsigned conn, struct mobile_connection_stats *stats);
+
+// Callback functions, as measured by the profiler
+enum mobile_callback {
+    MOBILE_CALLBACK_DEBUG_LOG,
+    MOBILE_CALLBACK_SERIAL_DISABLE,
+    MOBILE_CALLBACK_SERIAL_ENABLE,
+    MOBILE_CALLBACK_CONFIG_READ,
+    MOBILE_CALLBACK_CONFIG_WRITE,
+    MOBILE_CALLBACK_TIME_LATCH,
+    MOBILE_CALLBACK_TIME_CHECK_MS,
+    MOBILE_CALLBACK_SOCK_OPEN,
+    MOBILE_CALLBACK_SOCK_CLOSE,
+    MOBILE_CALLBACK_SOCK_CONNECT,
+    MOBILE_CALLBACK_SOCK_LISTEN,
+    MOBILE_CALLBACK_SOCK_ACCEPT,
+    MOBILE_CALLBACK_SOCK_SEND,
+    MOBILE_CALLBACK_SOCK_RECV,
+    MOBILE_CALLBACK_UPDATE_NUMBER,
+    MOBILE_CALLBACK_SOCK_CONNECT_DATA,
+    MOBILE_CALLBACK_SESSION_SUMMARY,  // Only with MOBILE_ENABLE_SUMMARY
+    MOBILE_MAX_CALLBACKS
+};
+
+struct mobile_profile_stats {
+    uint32_t calls;  // Amount of times the callback was called
+    uint32_t slow_calls;  // Amount of calls that exceeded the threshold
+    uint32_t max_us;  // Longest time a single call took
+    uint64_t total_us;  // Total time spent in the callback
+};
+
+// mobile_profile_set_threshold - Set the threshold for slow callbacks
+//
+// Any callback call that takes at least <threshold_us> microseconds to return
+// is counted as slow, see struct mobile_profile_stats. A <threshold_us> of 0
+// disables this.
+//
+// Only available when the library is built with MOBILE_ENABLE_PROFILER.
+//
+// Parameters:
+// - adapter: Library state
+// - threshold_us: Threshold in microseconds, 0 to disable
+void mobile_profile_set_threshold(struct mobile_adapter *adapter, uint32_t threshold_us);
+
+// mobile_profile_get - Get the profiler statistics of a callback
+//
+// Retrieves the statistics gathered for a specific callback since the library
+// was initialized, or since mobile_profile_reset() was last called. These can
+// be used to figure out if any stalls in mobile_loop() are caused by the
+// implementation of the callbacks, rather than the library itself.
+//
+// Only available when the library is built with MOBILE_ENABLE_PROFILER.
+//
+// Parameters:
+// - adapter: Library state
+// - callback: Callback to get the statistics of
+// - stats: Buffer to store the statistics in
+void mobile_profile_get(struct mobile_adapter *adapter, enum mobile_callback callback, struct mobile_profile_stats *stats);
+
+// mobile_profile_reset - Reset the profiler statistics
+//
+// Only available when the library is built with MOBILE_ENABLE_PROFILER.
+//
+// Parameters:
+// - adapter: Library state
+void mobile_profile_reset(struct mobile_adapter *adapter);
+
+// Amount of buckets in every latency histogram of struct mobile_session_summary
+// Bucket 0 counts latencies of 0ms, every other bucket <n> counts latencies of
+//   at least 2^(n-1)ms, and less than 2^n ms. The last bucket also counts
+//   anything longer than that.
+#define MOBILE_SUMMARY_LATENCY_BUCKETS 16
+
+// Commands are counted by their ID, IDs above this aren't counted
+#define MOBILE_SUMMARY_MAX_COMMANDS 0x40
+
+struct mobile_session_summary {
+    uint32_t duration_ms;  // Time between the START and END commands
+
+    // Amount of times every command was completed, and how many of them
+    //   returned an error
+    uint16_t commands[MOBILE_SUMMARY_MAX_COMMANDS];
+    uint16_t command_errors;
+
+    // Data exchanged through the DATA command, by connection ID
+    // Calls always use connection 0.
+    uint32_t bytes_sent[MOBILE_MAX_CONNECTIONS];
+    uint32_t bytes_recv[MOBILE_MAX_CONNECTIONS];
+
+    // DNS requests that were answered, and those that failed
+    uint16_t dns_hits;
+    uint16_t dns_misses;
+
+    // Latency histograms, in milliseconds
+    // The connect histogram counts the successful TEL and TCP_CONNECT
+    //   commands, the command histogram counts every command, measured from
+    //   the moment it was received to the moment its reply was ready.
+    uint16_t latency_connect[MOBILE_SUMMARY_LATENCY_BUCKETS];
+    uint16_t latency_command[MOBILE_SUMMARY_LATENCY_BUCKETS];
+
+    // Packets with a bad checksum, packets with an unknown command, and
+    //   replies that had to be resent because the game reported an error
+    uint16_t serial_checksum_errors;
+    uint16_t serial_unknown_commands;
+    uint16_t serial_resends;
+};
+
+// mobile_summary_quantile - Estimate a quantile from a latency histogram
+//
+// Finds the bucket of <latency> that contains the <percent>th percentile of
+// the measured latencies, and returns the highest latency that fits in that
+// bucket. The result is only accurate within a factor of two.
+//
+// Parameters:
+// - latency: Histogram of MOBILE_SUMMARY_LATENCY_BUCKETS entries, from
+//            struct mobile_session_summary
+// - percent: Percentile to find, from 0 to 100
+// Returns: Latency in milliseconds, or 0 if the histogram is empty
+unsigned mobile_summary_quantile(const uint16_t *latency, unsigned percent);
+
 // mobile_config_load - Manually force a load of the configuration values
 //
 // Makes sure the configuration has been loaded. The configuration is loaded
@@ -476,6 +786,17 @@ void mobile_actions_process(struct mobile_adapter *adapter, enum mobile_action a
 // - adapter: Library state
 void mobile_loop(struct mobile_adapter *adapter);
 
+// mobile_loop_cycles - Library main loop, advancing the time
+//
+// Equivalent to mobile_loop(), but additionally advances the time by the
+// amount of clock cycles elapsed since the last call that passed any cycles.
+// See mobile_time_set_rate() for more information.
+//
+// Parameters:
+// - adapter: Library state
+// - cycles: Clock cycles elapsed since any cycles were last passed
+void mobile_loop_cycles(struct mobile_adapter *adapter, uint32_t cycles);
+
 // mobile_transfer - Exchange a byte between the adapter and the console
 // mobile_transfer_32bit - Exchange a word between the adapter and the console
 //
@@ -521,6 +842,65 @@ void mobile_loop(struct mobile_adapter *adapter);
 uint8_t mobile_transfer(struct mobile_adapter *adapter, uint8_t c);
 uint32_t mobile_transfer_32bit(struct mobile_adapter *adapter, uint32_t c);
 
+// mobile_transfer_predict - Predict the data of the next exchanges
+//
+// Retrieves the data that will be returned by the next calls to
+// mobile_transfer() or mobile_transfer_32bit(), as far as it's known at this
+// point in time, regardless of the data that will be received from the
+// console. This is useful for hardware bridges, which may clock out the
+// predicted data on their own, without waiting for libmobile to process each
+// individual exchange. See also mobile_bridge_init().
+//
+// Most of the time, this will be a run of idle bytes, or a full response
+// packet. In 8bit mode, the device byte sent after a packet has been received
+// is included as soon as the size of the packet is known. The data that
+// depends on what's received from the console, such as the acknowledgement of
+// a packet, is never predicted.
+//
+// In 32bit mode, the data is predicted in whole words, with the most
+// significant byte first.
+//
+// As this function inspects the serial state, it may only be called where
+// mobile_transfer() may be called, in the same thread.
+//
+// Parameters:
+// - adapter: Library state
+// - data: Buffer to store the predicted data in
+// - size: Maximum amount of bytes to predict
+// Returns: Amount of bytes predicted
+unsigned mobile_transfer_predict(struct mobile_adapter *adapter, unsigned char *data, unsigned size);
+
+// mobile_transfer_cycles - Exchange a byte, advancing the time
+// mobile_transfer_32bit_cycles - Exchange a word, advancing the time
+//
+// Equivalent to mobile_transfer() and mobile_transfer_32bit(), but
+// additionally advance the time by the amount of clock cycles elapsed since
+// the last call that passed any cycles. See mobile_time_set_rate() for more
+// information.
+//
+// The elapsed cycles are picked up by the next call to mobile_loop(), and are
+// safe to pass along from a different thread.
+//
+// Parameters:
+// - adapter: Library state
+// - c: Data received in previous exchange
+// - cycles: Clock cycles elapsed since any cycles were last passed
+// Returns: Data to send in next exchange
+uint8_t mobile_transfer_cycles(struct mobile_adapter *adapter, uint8_t c, uint32_t cycles);
+uint32_t mobile_transfer_32bit_cycles(struct mobile_adapter *adapter, uint32_t c, uint32_t cycles);
+
+// mobile_time_advance_serial - Advance the time without exchanging data
+//
+// Passes the amount of clock cycles elapsed since the last call that passed
+// any cycles, like mobile_transfer_cycles() does, without exchanging anything.
+// Used when the serial clock stops, but time keeps passing on the console.
+// Must be called from the same thread as mobile_transfer_cycles().
+//
+// Parameters:
+// - adapter: Library state
+// - cycles: Clock cycles elapsed since any cycles were last passed
+void mobile_time_advance_serial(struct mobile_adapter *adapter, uint32_t cycles);
+
 // mobile_start - Begin the library operation
 //
 // Does necessary post-initialization, such as making sure the configuration is
@@ -548,6 +928,31 @@ void mobile_start(struct mobile_adapter *adapter);
 // - adapter: Library state
 void mobile_stop(struct mobile_adapter *adapter);
 
+// mobile_drain - Stop accepting new connections
+// mobile_drained - Check if the adapter is no longer in use
+//
+// Allows shutting down the library without cutting off a game that's in the
+// middle of using it, as mobile_stop() would do. While draining, the adapter
+// keeps serving the sessions and connections that are already active, but
+// refuses to make calls, wait for calls or log in to the internet, answering
+// such requests as if the line was busy. A number fetch that's already running
+// is allowed to finish, but no new one is started.
+//
+// Once mobile_drained() returns true, no session is active and the library
+// isn't using any sockets, so mobile_stop() can be called without disrupting
+// anything. Games that start a new session afterwards can only use it for
+// things that don't require a connection. An <enable> of false returns the
+// adapter to normal operation.
+//
+// These functions must be called from the same thread as mobile_loop().
+//
+// Parameters:
+// - adapter: Library state
+// - enable: Whether to drain the adapter
+// Returns: true if the adapter is draining and isn't in use anymore
+void mobile_drain(struct mobile_adapter *adapter, bool enable);
+bool mobile_drained(struct mobile_adapter *adapter);
+
 // mobile_init - Initialize library
 //
 // Initializes the library state at <adapter>. No other functions may be used
@@ -590,6 +995,598 @@ struct mobile_adapter *mobile_new(void *user);
 // themselves, here is a sizeof(struct mobile_adapter).
 extern const size_t mobile_sizeof;
 
+// Passive sniffer
+//
+// The sniffer decodes a captured link between a real console and a real
+// adapter, without taking part in the communication. Every packet sent in
+// either direction is reported through a callback, along with the timestamps
+// of its first and last byte exchange, allowing to measure e.g. the time the
+// adapter takes to reply to each command.
+
+enum mobile_sniffer_source {
+    MOBILE_SNIFFER_CONSOLE,  // Packet sent by the console
+    MOBILE_SNIFFER_ADAPTER  // Packet sent by the adapter
+};
+
+struct mobile_sniffer_packet {
+    enum mobile_sniffer_source source;
+    unsigned char command;  // Command ID, as sent in the header
+    unsigned char length;
+    const unsigned char *data;
+    bool checksum_ok;  // Whether the checksum of the packet was correct
+    unsigned char device;  // Device ID sent back by the receiving side
+    unsigned char ack;  // Acknowledgement or error sent by the receiving side
+    uint32_t time_start;  // Timestamp of the first preamble byte exchange
+    uint32_t time_end;  // Timestamp of the last acknowledgement exchange
+};
+
+// mobile_func_sniffer_packet - Receive a decoded packet
+//
+// Called by the sniffer whenever a packet has been completely transferred,
+// including its acknowledgement. The <packet> is only valid for the duration
+// of the call.
+//
+// Parameters:
+// - packet: Decoded packet
+typedef void (*mobile_func_sniffer_packet)(void *user, const struct mobile_sniffer_packet *packet);
+
+// mobile_sniffer_transfer - Decode a captured byte exchange
+// mobile_sniffer_transfer_32bit - Decode a captured word exchange
+//
+// Feeds the data exchanged in both directions during a single transfer into
+// the sniffer. The <timestamp> may use any unit, and is passed back as-is in
+// the decoded packets.
+//
+// The sniffer follows the changes to the serial mode, the 32bit function is
+// merely a shorthand for the 8bit one, transferring the most significant
+// byte first.
+//
+// Parameters:
+// - sniffer: Sniffer state
+// - console: Data sent by the console
+// - adapter: Data sent by the adapter
+// - timestamp: Time of the exchange
+void mobile_sniffer_transfer(struct mobile_sniffer *sniffer, uint8_t console, uint8_t adapter, uint32_t timestamp);
+void mobile_sniffer_transfer_32bit(struct mobile_sniffer *sniffer, uint32_t console, uint32_t adapter, uint32_t timestamp);
+
+// mobile_sniffer_init - Initialize sniffer
+//
+// Initializes the sniffer state at <sniffer>. The sniffer is completely
+// independent of any struct mobile_adapter. Memory for it may be allocated
+// using mobile_sniffer_new(), or by reserving mobile_sniffer_sizeof bytes.
+//
+// Parameters:
+// - sniffer: Sniffer state
+// - func: Function called for every decoded packet
+// - user: User data pointer for the callback
+void mobile_sniffer_init(struct mobile_sniffer *sniffer, mobile_func_sniffer_packet func, void *user);
+
+// mobile_sniffer_new - Allocate memory and initialize sniffer
+//
+// See mobile_new() and mobile_sniffer_init().
+//
+// Parameters:
+// - func: Function called for every decoded packet
+// - user: User data pointer for the callback
+// Returns: Sniffer state
+struct mobile_sniffer *mobile_sniffer_new(mobile_func_sniffer_packet func, void *user);
+
+extern const size_t mobile_sniffer_sizeof;
+
+// Hardware bridge driver
+//
+// A hardware bridge is a microcontroller wired to the serial port of a real
+// console, connected to the host through a UART or any other byte stream. The
+// bridge clocks out the data libmobile will send ahead of time, and reports
+// the data it received in batches, so the host isn't required to answer every
+// byte exchange in time. The protocol spoken over the byte stream is described
+// in bridge.c.
+//
+// The driver doesn't perform any I/O by itself, the host passes any data read
+// from the stream to mobile_bridge_recv(), and writes the data given to the
+// mobile_func_bridge_write callback to it. The driver takes care of calling
+// mobile_transfer() for every exchange, and the serial callbacks should merely
+// return success.
+//
+// If a timebase is configured with a rate of 1000000 through
+// mobile_time_set_rate(), the timestamps reported by the bridge drive the
+// timers of the library.
+
+struct mobile_bridge_stats {
+    unsigned long exchanges;  // Byte exchanges reported by the bridge
+    unsigned long runs;  // Runs of data sent to the bridge
+    unsigned long slips;  // Exchanges held back due to a late run
+    unsigned long frames_invalid;  // Malformed frames received
+};
+
+// mobile_func_bridge_write - Write data to the bridge
+//
+// Called by the driver to send a frame to the bridge. The whole frame should
+// be written before returning.
+//
+// Parameters:
+// - data: Data to be written
+// - size: Size of the data
+typedef void (*mobile_func_bridge_write)(void *user, const void *data, unsigned size);
+
+// mobile_bridge_recv - Process data received from the bridge
+//
+// Decodes the frames sent by the bridge, passing every exchange reported
+// through it to libmobile, and sends the data to clock out next back to the
+// bridge. Partial frames are kept until the rest of their data is received.
+//
+// This function takes the role of the serial thread, and may not be called
+// concurrently with mobile_loop().
+//
+// Parameters:
+// - bridge: Bridge driver state
+// - data: Data read from the bridge
+// - size: Size of the data
+void mobile_bridge_recv(struct mobile_bridge *bridge, const void *data, unsigned size);
+
+// mobile_bridge_poll - Update the bridge after processing
+//
+// Should be called after every call to mobile_loop(), to send any response
+// that became available to the bridge.
+//
+// Parameters:
+// - bridge: Bridge driver state
+void mobile_bridge_poll(struct mobile_bridge *bridge);
+
+// mobile_bridge_get_stats - Retrieve the driver's counters
+//
+// Parameters:
+// - bridge: Bridge driver state
+// - stats: Buffer to store the counters in
+void mobile_bridge_get_stats(struct mobile_bridge *bridge, struct mobile_bridge_stats *stats);
+
+// mobile_bridge_init - Initialize bridge driver
+//
+// Initializes the driver state at <bridge>, for use with the library state at
+// <adapter>. Memory for the driver state may be allocated using
+// mobile_bridge_new(), or by reserving mobile_bridge_sizeof bytes.
+//
+// Parameters:
+// - bridge: Bridge driver state
+// - adapter: Library state
+// - func: Function used to write data to the bridge
+// - user: User data pointer for the callback
+void mobile_bridge_init(struct mobile_bridge *bridge, struct mobile_adapter *adapter, mobile_func_bridge_write func, void *user);
+
+// mobile_bridge_new - Allocate memory and initialize bridge driver
+//
+// See mobile_new() and mobile_bridge_init().
+//
+// Parameters:
+// - adapter: Library state
+// - func: Function used to write data to the bridge
+// - user: User data pointer for the callback
+// Returns: Bridge driver state
+struct mobile_bridge *mobile_bridge_new(struct mobile_adapter *adapter, mobile_func_bridge_write func, void *user);
+
+extern const size_t mobile_bridge_sizeof;
+
+// BGB link protocol frontend
+//
+// Many emulators link with other emulators through the BGB link protocol,
+// over a TCP connection. This frontend speaks the protocol on behalf of the
+// adapter, exchanging a byte for every SYNC1 packet sent by the emulator. The
+// replies are batched into a single write for all of the data passed to
+// mobile_bgb_recv() at once, and timestamp syncs are coalesced.
+//
+// The frontend doesn't perform any I/O by itself. The host is responsible for
+// the TCP connection, which should have TCP_NODELAY enabled, as every byte
+// exchange waits for the reply. The serial callbacks should merely return
+// success.
+//
+// The emulator's timestamps drive the timers of the library, see
+// mobile_bgb_init().
+
+// mobile_func_bgb_write - Write data to the emulator
+//
+// Called by the frontend to send packets to the emulator. All of the data
+// should be written before returning.
+//
+// Parameters:
+// - data: Data to be written
+// - size: Size of the data
+typedef void (*mobile_func_bgb_write)(void *user, const void *data, unsigned size);
+
+// mobile_bgb_connected - Start the protocol on a new connection
+//
+// Should be called whenever a connection to the emulator has been
+// established, to send the initial handshake and reset the protocol state.
+//
+// Parameters:
+// - bgb: BGB frontend state
+void mobile_bgb_connected(struct mobile_bgb *bgb);
+
+// mobile_bgb_recv - Process data received from the emulator
+//
+// Processes every packet received from the emulator, and writes out the
+// replies. Partial packets are kept until the rest of their data is received.
+//
+// This function takes the role of the serial thread, and may not be called
+// concurrently with mobile_loop().
+//
+// Parameters:
+// - bgb: BGB frontend state
+// - data: Data read from the connection
+// - size: Size of the data
+// Returns: false if the connection should be closed
+bool mobile_bgb_recv(struct mobile_bgb *bgb, const void *data, unsigned size);
+
+// mobile_bgb_init - Initialize BGB frontend
+//
+// Initializes the frontend state at <bgb>, for use with the library state at
+// <adapter>. This configures the timebase of the library to follow the
+// emulator's clock, see mobile_time_set_rate(), and as such must be called
+// after mobile_init(). Memory for the frontend state may be allocated using
+// mobile_bgb_new(), or by reserving mobile_bgb_sizeof bytes.
+//
+// Parameters:
+// - bgb: BGB frontend state
+// - adapter: Library state
+// - func: Function used to write data to the emulator
+// - user: User data pointer for the callback
+void mobile_bgb_init(struct mobile_bgb *bgb, struct mobile_adapter *adapter, mobile_func_bgb_write func, void *user);
+
+// mobile_bgb_new - Allocate memory and initialize BGB frontend
+//
+// See mobile_new() and mobile_bgb_init().
+//
+// Parameters:
+// - adapter: Library state
+// - func: Function used to write data to the emulator
+// - user: User data pointer for the callback
+// Returns: BGB frontend state
+struct mobile_bgb *mobile_bgb_new(struct mobile_adapter *adapter, mobile_func_bgb_write func, void *user);
+
+extern const size_t mobile_bgb_sizeof;
+
+// Trace-replay tuner
+//
+// The best values for the timeouts depend on the traffic of each game. The
+// tuner records the console's side of a session captured with the sniffer,
+// and replays it through an adapter under virtual time, playing the part of
+// the console. It then searches the timeout table for the values that replay
+// with the lowest 99th percentile command turnaround, without failing any
+// more commands. The tuned values may be stored as the game's profile, and
+// applied to other adapters through mobile_time_set_timeout().
+//
+// The adapter is taken over by the tuner while mobile_tuner_run() is running,
+// and is restarted for every replay. Its socket callbacks act as the simulated
+// network, and may use mobile_tuner_time() as their clock. The serial mode
+// isn't followed, traces are replayed in 8bit mode.
+
+struct mobile_tuner_result {
+    unsigned commands;  // Amount of commands replayed
+    unsigned failures;  // Commands without a reply, or replied with an error
+    uint32_t p99_ms;  // 99th percentile turnaround of the commands
+    unsigned timeouts[MOBILE_MAX_TIMEOUTS];  // Table the trace was replayed with
+};
+
+// mobile_tuner_record - Record a packet of the captured session
+//
+// Should be called with every packet decoded by the sniffer, from the
+// mobile_func_sniffer_packet callback. The timestamps passed to
+// mobile_sniffer_transfer() must be in milliseconds. Once the trace is full,
+// further packets are ignored.
+//
+// Parameters:
+// - tuner: Tuner state
+// - packet: Decoded packet
+void mobile_tuner_record(struct mobile_tuner *tuner, const struct mobile_sniffer_packet *packet);
+
+// mobile_tuner_run - Search the timeout table
+//
+// Replays the recorded trace with the adapter's current timeouts, and then
+// with every candidate value. The tuned timeouts are returned in <tuned>, and
+// aren't applied to the adapter: once done, its timeouts and clock rate are
+// restored, and it's started again if it was started before.
+//
+// Returns: false if nothing has been recorded
+// Parameters:
+// - tuner: Tuner state
+// - baseline: Result with the initial timeouts, may be NULL
+// - tuned: Result with the tuned timeouts, may be NULL
+bool mobile_tuner_run(struct mobile_tuner *tuner, struct mobile_tuner_result *baseline, struct mobile_tuner_result *tuned);
+
+// mobile_tuner_time - Current virtual time of the replay
+//
+// Returns: milliseconds since the tuner was initialized
+// Parameters:
+// - tuner: Tuner state
+uint32_t mobile_tuner_time(const struct mobile_tuner *tuner);
+
+// mobile_tuner_init - Initialize tuner
+//
+// Initializes the tuner state at <tuner>, for use with the library state at
+// <adapter>, which must have been initialized with mobile_init(). While
+// replaying, the timebase of the library follows the virtual time, see
+// mobile_time_set_rate(). Memory for the tuner state may be allocated using
+// mobile_tuner_new(), or by reserving mobile_tuner_sizeof bytes.
+//
+// Parameters:
+// - tuner: Tuner state
+// - adapter: Library state
+void mobile_tuner_init(struct mobile_tuner *tuner, struct mobile_adapter *adapter);
+
+// mobile_tuner_new - Allocate memory and initialize tuner
+//
+// See mobile_new() and mobile_tuner_init().
+//
+// Parameters:
+// - adapter: Library state
+// Returns: Tuner state
+struct mobile_tuner *mobile_tuner_new(struct mobile_adapter *adapter);
+
+extern const size_t mobile_tuner_sizeof;
+
+// Session buffer pool
+//
+// Only available when the library is built with MOBILE_ENABLE_POOL.
+//
+// The buffers used while a game talks to the adapter are leased from a pool,
+// and returned whenever the adapter goes idle, see MOBILE_ENABLE_POOL in
+// mobile_config.h. A pool may be shared by any amount of adapters, and holds a
+// fixed amount of buffers. When it runs out, adapters ignore the game until a
+// buffer becomes available, as if the adapter wasn't connected.
+
+// mobile_pool_attach - Use a pool for the session buffers
+//
+// Makes the library state at <adapter> lease its buffers from <pool>. Must be
+// called after mobile_init(), and before mobile_start(). The pool must remain
+// valid until the adapter is stopped with mobile_stop().
+//
+// Parameters:
+// - adapter: Library state
+// - pool: Pool state
+void mobile_pool_attach(struct mobile_adapter *adapter, struct mobile_pool *pool);
+
+// mobile_pool_available - Get the amount of buffers that aren't leased
+//
+// Parameters:
+// - pool: Pool state
+// Returns: Amount of available buffers
+unsigned mobile_pool_available(struct mobile_pool *pool);
+
+// mobile_pool_init - Initialize pool
+//
+// Initializes the pool state at <pool>, handing out the buffers at <blocks>.
+// The memory at <blocks> must be at least <count> times
+// mobile_pool_block_sizeof bytes, aligned like memory returned by malloc().
+// Memory for the pool state may be allocated using mobile_pool_new(), or by
+// reserving mobile_pool_sizeof bytes.
+//
+// Parameters:
+// - pool: Pool state
+// - blocks: Memory for the buffers
+// - count: Amount of buffers
+void mobile_pool_init(struct mobile_pool *pool, void *blocks, unsigned count);
+
+// mobile_pool_new - Allocate memory and initialize pool
+//
+// Allocates the pool state along with the memory for its buffers, in a
+// single allocation. See mobile_new() and mobile_pool_init().
+//
+// Parameters:
+// - count: Amount of buffers
+// Returns: Pool state
+struct mobile_pool *mobile_pool_new(unsigned count);
+
+extern const size_t mobile_pool_sizeof;
+extern const size_t mobile_pool_block_sizeof;
+
+// Adapter groups
+//
+// Hosts with their own event loop (e.g. epoll, libuv) may group adapters
+// together, instead of calling mobile_loop() on every one of them periodically.
+// The group calls the mobile_func_group_wake callback whenever any of its
+// adapters needs attention, which should make the event loop call
+// mobile_group_dispatch(). On POSIX systems, the callback may write to an
+// eventfd or pipe watched by the event loop. The value returned by
+// mobile_group_dispatch() should be used to arm a timer (e.g. a timerfd) that
+// calls it again.
+//
+// An adapter needs attention when a packet from the game is waiting to be
+// processed, or the host calls mobile_group_notify() because one of the
+// adapter's sockets became ready. Adapters that are in the middle of something
+// are also serviced on every dispatch. Started adapters that aren't exchanging
+// anything with the game are only serviced once one of their timers is due,
+// e.g. to fetch their number or return their relay permits, and not at all if
+// none is pending. Stopped adapters aren't serviced at all.
+
+// mobile_func_group_wake - Wake up the event loop
+//
+// Called when any adapter of the group needs to be serviced by
+// mobile_group_dispatch(). This may be called from the serial thread, through
+// mobile_transfer(), and should thus be kept short. It's fine to call
+// mobile_group_dispatch() less often than this callback is called.
+typedef void (*mobile_func_group_wake)(void *user);
+
+// mobile_group_notify - Mark an adapter as needing attention
+//
+// Should be called whenever a socket of <adapter> becomes ready to be read
+// from or written to, or was connected. Does nothing if the adapter isn't part
+// of a group. May be called from any thread.
+//
+// Parameters:
+// - adapter: Library state
+void mobile_group_notify(struct mobile_adapter *adapter);
+
+// mobile_group_dispatch - Service the adapters of a group
+//
+// Calls mobile_loop() on every adapter of the group that needs attention. This
+// may not be called concurrently with mobile_loop() on any of its adapters.
+//
+// Parameters:
+// - group: Group state
+// Returns: milliseconds until the next dispatch, -1 if it's not needed until
+//   the wake callback is called
+int mobile_group_dispatch(struct mobile_group *group);
+
+// mobile_group_add - Add an adapter to a group
+//
+// An adapter may be part of only one group at a time. The adapter should be
+// removed from the group before calling mobile_init() on it again.
+//
+// Parameters:
+// - group: Group state
+// - adapter: Library state
+void mobile_group_add(struct mobile_group *group, struct mobile_adapter *adapter);
+
+// mobile_group_remove - Remove an adapter from a group
+//
+// Parameters:
+// - group: Group state
+// - adapter: Library state
+void mobile_group_remove(struct mobile_group *group, struct mobile_adapter *adapter);
+
+// mobile_group_set_relay_limit - Limit the rate of relay connections
+//
+// Allows the adapters of the group to open at most <limit> connections to the
+// relay server within any <window_ms> milliseconds, counting the connections
+// used to fetch the adapters' numbers, and those used to place or wait for
+// calls. This keeps the load on the relay bounded when many adapters connect
+// at once, e.g. when the host starts, or the relay comes back up. A single
+// adapter may take several of the connections of a window.
+//
+// Adapters that can't connect right away retry on the following dispatches.
+// Number fetches are simply delayed, TEL commands wait up to
+// MOBILE_TIMEOUT_CONNECT, and WAIT_CALL commands report that no call was
+// received. Retries of failed number fetches are further spread out by
+// MOBILE_TIMEOUT_RELAY_BACKOFF, and the first fetch after mobile_start() by
+// MOBILE_TIMEOUT_RELAY_STAGGER, see mobile_time_set_timeout().
+//
+// The window is measured by the timers of every adapter, see
+// mobile_func_time_latch() or mobile_time_set_rate().
+//
+// Parameters:
+// - group: Group state
+// - limit: Amount of connections per window, 0 for no limit
+// - window_ms: Length of the window, in milliseconds
+void mobile_group_set_relay_limit(struct mobile_group *group, unsigned limit, unsigned window_ms);
+
+// mobile_group_init - Initialize adapter group
+//
+// Initializes an empty group at <group>. Memory for the group state may be
+// allocated using mobile_group_new(), or by reserving mobile_group_sizeof
+// bytes.
+//
+// Parameters:
+// - group: Group state
+// - func: Function used to wake up the event loop
+// - user: User data pointer for the callback
+void mobile_group_init(struct mobile_group *group, mobile_func_group_wake func, void *user);
+
+// mobile_group_new - Allocate memory and initialize adapter group
+//
+// See mobile_new() and mobile_group_init().
+//
+// Parameters:
+// - func: Function used to wake up the event loop
+// - user: User data pointer for the callback
+// Returns: Group state
+struct mobile_group *mobile_group_new(mobile_func_group_wake func, void *user);
+
+extern const size_t mobile_group_sizeof;
+
+// Metrics
+//
+// Only available when the library is built with MOBILE_ENABLE_METRICS.
+//
+// Adapters may keep running counters in a block of memory provided by the
+// host, so that monitoring tools can read them without calling into the
+// library, or walking every adapter. On POSIX systems, this memory may be a
+// shared memory object mapped with mmap(), which other processes map as well.
+//
+// The block starts with a struct mobile_metrics, which holds the totals of
+// every adapter that was ever attached to it. It's followed by slot_count
+// slots of slot_size bytes, one for every adapter, each holding a struct
+// mobile_metrics_slot. Readers should check the magic and version fields, and
+// use slot_size to find the slots, as future versions may add fields to the
+// end of the slot.
+//
+// All counters are 32-bit and only ever increase, wrapping around when they
+// overflow. They're updated with relaxed atomic operations, and as such may
+// be read at any time, but the counters aren't updated all at once. Rates are
+// found by reading the counters periodically, and comparing them with the
+// previous reading.
+
+#define MOBILE_METRICS_MAGIC 0x4d424f4d  // "MOBM" in little endian
+#define MOBILE_METRICS_VERSION 1
+
+struct mobile_metrics_slot {
+    // Amount of times an adapter has been attached to this slot
+    uint32_t generation;
+
+    // Amount of sessions that were started
+    uint32_t sessions;
+
+    // Amount of times every command was completed within a session, and how
+    //   many of them returned an error, see struct mobile_session_summary
+    uint32_t commands[MOBILE_SUMMARY_MAX_COMMANDS];
+    uint32_t command_errors;
+
+    // Data exchanged through the DATA command, by connection ID
+    uint32_t bytes_sent[MOBILE_MAX_CONNECTIONS];
+    uint32_t bytes_recv[MOBILE_MAX_CONNECTIONS];
+
+    // DNS requests that were answered, and those that failed
+    uint32_t dns_hits;
+    uint32_t dns_misses;
+
+    // Latency histograms, see MOBILE_SUMMARY_LATENCY_BUCKETS and
+    //   struct mobile_session_summary
+    uint32_t latency_connect[MOBILE_SUMMARY_LATENCY_BUCKETS];
+    uint32_t latency_command[MOBILE_SUMMARY_LATENCY_BUCKETS];
+
+    // Serial errors, see struct mobile_session_summary
+    uint32_t serial_checksum_errors;
+    uint32_t serial_unknown_commands;
+    uint32_t serial_resends;
+};
+
+struct mobile_metrics {
+    uint32_t magic;  // MOBILE_METRICS_MAGIC once initialized
+    uint16_t version;  // MOBILE_METRICS_VERSION
+    uint16_t slot_size;  // Size of every slot, in bytes
+    uint32_t slot_count;
+    struct mobile_metrics_slot total;
+};
+
+// mobile_metrics_attach - Publish the counters of an adapter
+//
+// Makes the library state at <adapter> count into the slot numbered <slot> of
+// <metrics>, as well as into its totals. The slot is cleared, and its
+// generation counter is increased. Attaching an adapter to NULL stops it from
+// counting. Must be called after mobile_init(), while the adapter isn't
+// started. The metrics must remain valid until the adapter is attached
+// elsewhere, or isn't used anymore.
+//
+// Only one adapter should be attached to a slot at any time. Any amount of
+// adapters may be attached to the same metrics, from any amount of threads.
+//
+// Parameters:
+// - adapter: Library state
+// - metrics: Metrics initialized with mobile_metrics_init(), or NULL
+// - slot: Slot to count into, less than the slot count of <metrics>
+void mobile_metrics_attach(struct mobile_adapter *adapter, struct mobile_metrics *metrics, unsigned slot);
+
+// mobile_metrics_init - Initialize metrics
+//
+// Clears the metrics at <metrics>, and writes the fields that allow readers to
+// find the slots. The magic field is written last, so readers may wait for it
+// to be set. The memory at <metrics> must be at least
+// sizeof(struct mobile_metrics) + <slots> * sizeof(struct mobile_metrics_slot)
+// bytes, aligned to at least 4 bytes.
+//
+// Parameters:
+// - metrics: Memory for the metrics
+// - slots: Amount of slots
+void mobile_metrics_init(struct mobile_metrics *metrics, unsigned slots);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,33 +16,53 @@
 #include "mobile.h"
 #include "global.h"
 #include "callback.h"
+#include "timer.h"
+#include "profile.h"
 #include "config.h"
 #include "debug.h"
 #include "serial.h"
 #include "commands.h"
 #include "dns.h"
 #include "relay.h"
+#include "pool.h"
+#include "group.h"
+#include "summary.h"
+#include "metrics.h"
+
+// Memory shared across subsystems
+struct mobile_adapter_buffer {
+    union {
+        struct mobile_buffer_dns dns;
+        struct mobile_buffer_relay relay;
+    };
+    union {
+        struct mobile_buffer_serial serial;
+        struct mobile_buffer_commands commands;
+    };
+    struct mobile_buffer_relay relay_fetch;
+    struct mobile_buffer_relay_state relay_state;
+    struct mobile_buffer_connections connections;
+};
 
 struct mobile_adapter {
     void *user;
     struct mobile_adapter_global global;
     struct mobile_adapter_callback callback;
+    struct mobile_adapter_time time;
+    struct mobile_adapter_profile profile;
     struct mobile_adapter_config config;
     struct mobile_adapter_debug debug;
     struct mobile_adapter_serial serial;
     struct mobile_adapter_commands commands;
     struct mobile_adapter_dns dns;
-    struct mobile_adapter_relay relay;
+    struct mobile_adapter_pool pool;
+    struct mobile_adapter_group group;
+    struct mobile_adapter_summary summary;
+    struct mobile_adapter_metrics metrics;
 
-    // Memory shared across subsystems
-    struct {
-        union {
-            struct mobile_buffer_dns dns;
-            struct mobile_buffer_relay relay;
-        };
-        union {
-            struct mobile_buffer_serial serial;
-            struct mobile_buffer_commands commands;
-        };
-    } buffer;
+    // Leased from the pool while in use, with MOBILE_ENABLE_POOL
+    struct mobile_adapter_buffer *buffer;
+#ifndef MOBILE_ENABLE_POOL
+    struct mobile_adapter_buffer buffer_static;
+#endif
 };
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "pool.h"
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Session buffer pool
+// Most of the memory of the library state is only used while the adapter is
+//   talking to the game, or fetching its number from the relay. When
+//   MOBILE_ENABLE_POOL is set, this memory is leased from a pool shared by many
+//   adapters, and returned whenever the adapter goes idle. The serial thread
+//   leases the buffers as soon as the game starts sending a packet, so every
+//   adapter sharing a pool must be driven from the same thread.
+
+void mobile_buffer_init(struct mobile_adapter *adapter)
+{
+#ifdef MOBILE_ENABLE_POOL
+    adapter->pool.pool = NULL;
+    adapter->buffer = NULL;
+    adapter->serial.buffer = NULL;
+    adapter->debug.buffer = NULL;
+#else
+    adapter->buffer = &adapter->buffer_static;
+#endif
+}
+
+#ifdef MOBILE_ENABLE_POOL
+struct mobile_pool_block {
+    union {
+        struct mobile_pool_block *next;
+        struct mobile_adapter_buffer buffer;
+    };
+    unsigned char serial[MOBILE_MAX_DATA_SIZE];
+    char debug[MOBILE_DEBUG_BUFFER_SIZE];
+};
+
+// Returns: true if the adapter holds the buffers
+bool mobile_buffer_lease(struct mobile_adapter *adapter)
+{
+    struct mobile_pool *pool = adapter->pool.pool;
+
+    if (adapter->buffer) return true;
+    if (!pool || !pool->free) return false;
+
+    struct mobile_pool_block *block = pool->free;
+    pool->free = block->next;
+    pool->available--;
+
+    adapter->buffer = &block->buffer;
+    adapter->serial.buffer = block->serial;
+    adapter->debug.buffer = block->debug;
+    adapter->debug.current = 0;
+
+    // Caches kept in the block start out empty
+    mobile_relay_redirect_clear(adapter);
+    mobile_relay_number_forget(adapter);
+    return true;
+}
+
+void mobile_buffer_release(struct mobile_adapter *adapter)
+{
+    struct mobile_pool *pool = adapter->pool.pool;
+
+    if (!adapter->buffer) return;
+
+    // The buffer is the first member of the block
+    struct mobile_pool_block *block =
+        (struct mobile_pool_block *)adapter->buffer;
+    block->next = pool->free;
+    pool->free = block;
+    pool->available++;
+
+    adapter->buffer = NULL;
+    adapter->serial.buffer = NULL;
+    adapter->debug.buffer = NULL;
+    adapter->debug.current = 0;
+}
+
+void mobile_pool_attach(struct mobile_adapter *adapter, struct mobile_pool *pool)
+{
+    mobile_buffer_release(adapter);
+    adapter->pool.pool = pool;
+}
+
+unsigned mobile_pool_available(struct mobile_pool *pool)
+{
+    return pool->available;
+}
+
+void mobile_pool_init(struct mobile_pool *pool, void *blocks, unsigned count)
+{
+    struct mobile_pool_block *block = blocks;
+
+    pool->free = NULL;
+    for (unsigned i = count; i--;) {
+        block[i].next = pool->free;
+        pool->free = &block[i];
+    }
+    pool->available = count;
+}
+
+const size_t mobile_pool_sizeof PROGMEM = sizeof(struct mobile_pool);
+const size_t mobile_pool_block_sizeof PROGMEM =
+    sizeof(struct mobile_pool_block);
+
+#ifndef MOBILE_ENABLE_NOALLOC
+#include <stdlib.h>
+struct mobile_pool *mobile_pool_new(unsigned count)
+{
+    struct pool_alloc {
+        struct mobile_pool pool;
+        struct mobile_pool_block blocks[];
+    };
+
+    struct pool_alloc *alloc = malloc(sizeof(struct pool_alloc) +
+        sizeof(struct mobile_pool_block) * count);
+    mobile_pool_init(&alloc->pool, alloc->blocks, count);
+    return &alloc->pool;
+}
+#endif
+#endif
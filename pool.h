@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdbool.h>
+
+#include "mobile.h"
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
+struct mobile_pool_block;
+
+struct mobile_pool {
+    struct mobile_pool_block *free;
+    unsigned available;
+};
+
+struct mobile_adapter_pool {
+#ifdef MOBILE_ENABLE_POOL
+    struct mobile_pool *pool;
+#endif
+};
+
+void mobile_buffer_init(struct mobile_adapter *adapter);
+
+#ifdef MOBILE_ENABLE_POOL
+bool mobile_buffer_lease(struct mobile_adapter *adapter);
+void mobile_buffer_release(struct mobile_adapter *adapter);
+#endif
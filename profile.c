@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "profile.h"
+
+#include <string.h>
+
+#include "mobile_data.h"
+
+// Callback profiler
+// Every mobile_cb_* call is routed through the functions in this file when
+//   MOBILE_ENABLE_PROFILER is set, see callback.h.
+
+void mobile_profile_init(struct mobile_adapter *adapter)
+{
+#ifdef MOBILE_ENABLE_PROFILER
+    adapter->profile.threshold = 0;
+    mobile_profile_reset(adapter);
+#else
+    (void)adapter;
+#endif
+}
+
+#ifdef MOBILE_ENABLE_PROFILER
+static uint32_t profile_begin(struct mobile_adapter *adapter)
+{
+    return mobile_cb(profile_clock, adapter);
+}
+
+static void profile_end(struct mobile_adapter *adapter, enum mobile_callback callback, uint32_t start)
+{
+    struct mobile_adapter_profile *s = &adapter->profile;
+    struct mobile_profile_stats *stats = &s->stats[callback];
+
+    uint32_t time = mobile_cb(profile_clock, adapter) - start;
+
+    stats->calls++;
+    stats->total_us += time;
+    if (time > stats->max_us) stats->max_us = time;
+    if (s->threshold && time >= s->threshold) stats->slow_calls++;
+}
+
+void mobile_profile_cb_debug_log(struct mobile_adapter *adapter, const char *line)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(debug_log, adapter, line);
+    profile_end(adapter, MOBILE_CALLBACK_DEBUG_LOG, start);
+}
+
+void mobile_profile_cb_serial_disable(struct mobile_adapter *adapter)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(serial_disable, adapter);
+    profile_end(adapter, MOBILE_CALLBACK_SERIAL_DISABLE, start);
+}
+
+void mobile_profile_cb_serial_enable(struct mobile_adapter *adapter, bool mode_32bit)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(serial_enable, adapter, mode_32bit);
+    profile_end(adapter, MOBILE_CALLBACK_SERIAL_ENABLE, start);
+}
+
+bool mobile_profile_cb_config_read(struct mobile_adapter *adapter, void *dest, uintptr_t offset, size_t size)
+{
+    uint32_t start = profile_begin(adapter);
+    bool rc = mobile_cb(config_read, adapter, dest, offset, size);
+    profile_end(adapter, MOBILE_CALLBACK_CONFIG_READ, start);
+    return rc;
+}
+
+bool mobile_profile_cb_config_write(struct mobile_adapter *adapter, const void *src, uintptr_t offset, size_t size)
+{
+    uint32_t start = profile_begin(adapter);
+    bool rc = mobile_cb(config_write, adapter, src, offset, size);
+    profile_end(adapter, MOBILE_CALLBACK_CONFIG_WRITE, start);
+    return rc;
+}
+
+void mobile_profile_cb_time_latch(struct mobile_adapter *adapter, unsigned timer)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(time_latch, adapter, timer);
+    profile_end(adapter, MOBILE_CALLBACK_TIME_LATCH, start);
+}
+
+bool mobile_profile_cb_time_check_ms(struct mobile_adapter *adapter, unsigned timer, unsigned ms)
+{
+    uint32_t start = profile_begin(adapter);
+    bool rc = mobile_cb(time_check_ms, adapter, timer, ms);
+    profile_end(adapter, MOBILE_CALLBACK_TIME_CHECK_MS, start);
+    return rc;
+}
+
+bool mobile_profile_cb_sock_open(struct mobile_adapter *adapter, unsigned conn, enum mobile_socktype type, enum mobile_addrtype addrtype, unsigned bindport)
+{
+    uint32_t start = profile_begin(adapter);
+    bool rc = mobile_cb(sock_open, adapter, conn, type, addrtype, bindport);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_OPEN, start);
+    return rc;
+}
+
+void mobile_profile_cb_sock_close(struct mobile_adapter *adapter, unsigned conn)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(sock_close, adapter, conn);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_CLOSE, start);
+}
+
+int mobile_profile_cb_sock_connect(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr)
+{
+    uint32_t start = profile_begin(adapter);
+    int rc = mobile_cb(sock_connect, adapter, conn, addr);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_CONNECT, start);
+    return rc;
+}
+
+bool mobile_profile_cb_sock_listen(struct mobile_adapter *adapter, unsigned conn)
+{
+    uint32_t start = profile_begin(adapter);
+    bool rc = mobile_cb(sock_listen, adapter, conn);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_LISTEN, start);
+    return rc;
+}
+
+bool mobile_profile_cb_sock_accept(struct mobile_adapter *adapter, unsigned conn)
+{
+    uint32_t start = profile_begin(adapter);
+    bool rc = mobile_cb(sock_accept, adapter, conn);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_ACCEPT, start);
+    return rc;
+}
+
+int mobile_profile_cb_sock_send(struct mobile_adapter *adapter, unsigned conn, const void *data, unsigned size, const struct mobile_addr *addr)
+{
+    uint32_t start = profile_begin(adapter);
+    int rc = mobile_cb(sock_send, adapter, conn, data, size, addr);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_SEND, start);
+    return rc;
+}
+
+int mobile_profile_cb_sock_recv(struct mobile_adapter *adapter, unsigned conn, void *data, unsigned size, struct mobile_addr *addr)
+{
+    uint32_t start = profile_begin(adapter);
+    int rc = mobile_cb(sock_recv, adapter, conn, data, size, addr);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_RECV, start);
+    return rc;
+}
+
+void mobile_profile_cb_update_number(struct mobile_adapter *adapter, enum mobile_number type, const char *number)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(update_number, adapter, type, number);
+    profile_end(adapter, MOBILE_CALLBACK_UPDATE_NUMBER, start);
+}
+
+int mobile_profile_cb_sock_connect_data(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr, const void *data, unsigned size)
+{
+    uint32_t start = profile_begin(adapter);
+    int rc = mobile_cb(sock_connect_data, adapter, conn, addr, data, size);
+    profile_end(adapter, MOBILE_CALLBACK_SOCK_CONNECT_DATA, start);
+    return rc;
+}
+
+#ifdef MOBILE_ENABLE_SUMMARY
+void mobile_profile_cb_session_summary(struct mobile_adapter *adapter, const struct mobile_session_summary *summary)
+{
+    uint32_t start = profile_begin(adapter);
+    mobile_cb(session_summary, adapter, summary);
+    profile_end(adapter, MOBILE_CALLBACK_SESSION_SUMMARY, start);
+}
+#endif
+
+void mobile_profile_set_threshold(struct mobile_adapter *adapter, uint32_t threshold_us)
+{
+    adapter->profile.threshold = threshold_us;
+}
+
+void mobile_profile_get(struct mobile_adapter *adapter, enum mobile_callback callback, struct mobile_profile_stats *stats)
+{
+    if (callback >= MOBILE_MAX_CALLBACKS) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = adapter->profile.stats[callback];
+}
+
+void mobile_profile_reset(struct mobile_adapter *adapter)
+{
+    memset(adapter->profile.stats, 0, sizeof(adapter->profile.stats));
+}
+#endif
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mobile.h"
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
+struct mobile_adapter_profile {
+#ifdef MOBILE_ENABLE_PROFILER
+    uint32_t threshold;
+    struct mobile_profile_stats stats[MOBILE_MAX_CALLBACKS];
+#endif
+};
+
+void mobile_profile_init(struct mobile_adapter *adapter);
+
+#ifdef MOBILE_ENABLE_PROFILER
+void mobile_profile_cb_debug_log(struct mobile_adapter *adapter, const char *line);
+void mobile_profile_cb_serial_disable(struct mobile_adapter *adapter);
+void mobile_profile_cb_serial_enable(struct mobile_adapter *adapter, bool mode_32bit);
+bool mobile_profile_cb_config_read(struct mobile_adapter *adapter, void *dest, uintptr_t offset, size_t size);
+bool mobile_profile_cb_config_write(struct mobile_adapter *adapter, const void *src, uintptr_t offset, size_t size);
+void mobile_profile_cb_time_latch(struct mobile_adapter *adapter, unsigned timer);
+bool mobile_profile_cb_time_check_ms(struct mobile_adapter *adapter, unsigned timer, unsigned ms);
+bool mobile_profile_cb_sock_open(struct mobile_adapter *adapter, unsigned conn, enum mobile_socktype type, enum mobile_addrtype addrtype, unsigned bindport);
+void mobile_profile_cb_sock_close(struct mobile_adapter *adapter, unsigned conn);
+int mobile_profile_cb_sock_connect(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr);
+bool mobile_profile_cb_sock_listen(struct mobile_adapter *adapter, unsigned conn);
+bool mobile_profile_cb_sock_accept(struct mobile_adapter *adapter, unsigned conn);
+int mobile_profile_cb_sock_send(struct mobile_adapter *adapter, unsigned conn, const void *data, unsigned size, const struct mobile_addr *addr);
+int mobile_profile_cb_sock_recv(struct mobile_adapter *adapter, unsigned conn, void *data, unsigned size, struct mobile_addr *addr);
+void mobile_profile_cb_update_number(struct mobile_adapter *adapter, enum mobile_number type, const char *number);
+int mobile_profile_cb_sock_connect_data(struct mobile_adapter *adapter, unsigned conn, const struct mobile_addr *addr, const void *data, unsigned size);
+#ifdef MOBILE_ENABLE_SUMMARY
+void mobile_profile_cb_session_summary(struct mobile_adapter *adapter, const struct mobile_session_summary *summary);
+#endif
+#endif
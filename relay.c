@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "mobile_data.h"
+#include "util.h"
 #include "compat.h"
 
 // Protocol description:
@@ -19,17 +20,29 @@
 // token is generated, which may be kept secret by the client to keep the
 // assigned number across multiple connections and application restarts. The
 // phone numbers are expected to be exchanged between users.
+//
+// The numbers may be spread across several servers. When a server receives a
+// call for a number it doesn't serve, it may redirect the client to the server
+// that does, by replying with the REDIRECT result, followed by its address:
+// - u8 type: 1 for IPv4, 2 for IPv6
+// - u16be port
+// - u8 host[4 or 16]
+// The client then connects and authenticates with that server, and repeats
+// the call. A token or number issued by that server is only valid there, and
+// never replaces the user's. Redirects are remembered for the most recently
+// called numbers while the adapter's buffers are held, so further calls go to
+// the right server directly.
 
 #define PROTOCOL_VERSION 0
 
 // Maximum number size
-#define MOBILE_RELAY_MAX_NUMBER_SIZE 16
 static_assert(MOBILE_MAX_NUMBER_SIZE >= MOBILE_RELAY_MAX_NUMBER_SIZE,
     "MOBILE_MAX_NUMBER_SIZE isn't big enough!");
 
 // Maximum packet sizes
 //#define MAX_HANDSHAKE_SIZE (7 + 1 + MOBILE_RELAY_TOKEN_SIZE)  // 24
 //#define MAX_COMMAND_CALL_SIZE (3 + MOBILE_RELAY_MAX_NUMBER_SIZE)  // 19
+//#define MAX_COMMAND_CALL_REDIRECT_SIZE (3 + 3 + MOBILE_HOSTLEN_IPV6)  // 22
 //#define MAX_COMMAND_WAIT_SIZE (4 + MOBILE_RELAY_MAX_NUMBER_SIZE)  // 20
 //#define MAX_COMMAND_GET_NUMBER_SIZE (3 + MOBILE_RELAY_MAX_NUMBER_SIZE)  // 19
 static_assert(MOBILE_RELAY_PACKET_SIZE >= 24,
@@ -40,10 +53,100 @@ static const unsigned char handshake_magic[] PROGMEM = {
     'M', 'O', 'B', 'I', 'L', 'E',
 };
 
-void mobile_relay_init(struct mobile_adapter *adapter)
+// The number fetch runs on its own connection, alongside any call
+static struct mobile_relay_link *relay_link(struct mobile_adapter *adapter, unsigned char conn)
+{
+    if (conn == MOBILE_NUMBER_FETCH_CONN) return &adapter->buffer->relay_state.fetch;
+    return &adapter->buffer->relay_state.call;
+}
+
+static struct mobile_buffer_relay *relay_buffer(struct mobile_adapter *adapter, unsigned char conn)
+{
+    if (conn == MOBILE_NUMBER_FETCH_CONN) return &adapter->buffer->relay_fetch;
+    return &adapter->buffer->relay;
+}
+
+void mobile_relay_init(struct mobile_adapter *adapter, unsigned char conn)
+{
+    struct mobile_relay_link *s = relay_link(adapter, conn);
+
+    s->state = MOBILE_RELAY_DISCONNECTED;
+    s->processing = 0;
+}
+
+void mobile_relay_redirect_clear(struct mobile_adapter *adapter)
+{
+    // Nothing is remembered while no buffer is leased
+    if (!adapter->buffer) return;
+    struct mobile_buffer_relay_state *b = &adapter->buffer->relay_state;
+
+    for (unsigned i = 0; i < MOBILE_RELAY_MAX_REDIRECTS; i++) {
+        b->redirects[i].number_len = 0;
+    }
+    b->redirects_next = 0;
+}
+
+// Forget the number assigned by the server, as the token or server changed
+void mobile_relay_number_forget(struct mobile_adapter *adapter)
+{
+    if (!adapter->buffer) return;
+    adapter->buffer->relay_state.number_len = 0;
+}
+
+static void relay_number_set(struct mobile_adapter *adapter, const char *number, unsigned number_len)
+{
+    struct mobile_buffer_relay_state *s = &adapter->buffer->relay_state;
+
+    memcpy(s->number, number, number_len);
+    s->number_len = number_len;
+}
+
+static struct mobile_relay_redirect *relay_redirect_find(struct mobile_adapter *adapter, const char *number, unsigned number_len)
+{
+    struct mobile_buffer_relay_state *b = &adapter->buffer->relay_state;
+
+    if (!number_len) return NULL;
+    for (unsigned i = 0; i < MOBILE_RELAY_MAX_REDIRECTS; i++) {
+        struct mobile_relay_redirect *r = &b->redirects[i];
+        if (r->number_len != number_len) continue;
+        if (memcmp(r->number, number, number_len) == 0) return r;
+    }
+    return NULL;
+}
+
+// Returns the server a number was redirected to, if known
+const struct mobile_addr *mobile_relay_redirect_get(struct mobile_adapter *adapter, const char *number, unsigned number_len)
 {
-    adapter->relay.state = MOBILE_RELAY_DISCONNECTED;
-    adapter->relay.processing = 0;
+    struct mobile_relay_redirect *r =
+        relay_redirect_find(adapter, number, number_len);
+    if (!r) return NULL;
+    return &r->server;
+}
+
+void mobile_relay_redirect_forget(struct mobile_adapter *adapter, const char *number, unsigned number_len)
+{
+    struct mobile_relay_redirect *r =
+        relay_redirect_find(adapter, number, number_len);
+    if (r) r->number_len = 0;
+}
+
+static void relay_redirect_set(struct mobile_adapter *adapter, const char *number, unsigned number_len, const struct mobile_addr *server)
+{
+    struct mobile_buffer_relay_state *b = &adapter->buffer->relay_state;
+
+    if (number_len > MOBILE_RELAY_MAX_NUMBER_SIZE) return;
+
+    // Replace the oldest entry if the number isn't known yet
+    struct mobile_relay_redirect *r =
+        relay_redirect_find(adapter, number, number_len);
+    if (!r) {
+        r = &b->redirects[b->redirects_next++];
+        b->redirects_next %= MOBILE_RELAY_MAX_REDIRECTS;
+    }
+
+    r->number_len = number_len;
+    memcpy(r->number, number, number_len);
+    mobile_addr_copy(&r->server, server);
 }
 
 static void debug_prefix(struct mobile_adapter *adapter)
@@ -51,9 +154,9 @@ static void debug_prefix(struct mobile_adapter *adapter)
     mobile_debug_print(adapter, PSTR("<RELAY> "));
 }
 
-static void relay_recv_reset(struct mobile_adapter *adapter)
+static void relay_recv_reset(struct mobile_adapter *adapter, unsigned char conn)
 {
-    adapter->buffer.relay.size = 0;
+    relay_buffer(adapter, conn)->size = 0;
 }
 
 // Makes sure at least size bytes have been received, tries to read more if not.
@@ -61,7 +164,7 @@ static void relay_recv_reset(struct mobile_adapter *adapter)
 //   been received, and -1 if an error occurred.
 static int relay_recv(struct mobile_adapter *adapter, unsigned conn, unsigned size)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     if (size > MOBILE_RELAY_PACKET_SIZE) return -1;
     if (b->size >= size) return (int)size;
@@ -93,9 +196,10 @@ static void relay_handshake_send_debug(struct mobile_adapter *adapter)
     mobile_debug_endl(adapter);
 }
 
-static bool relay_handshake_send(struct mobile_adapter *adapter, unsigned char conn)
+// Returns the size of the handshake written to the buffer
+static unsigned relay_handshake_build(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     unsigned size = sizeof(handshake_magic) + 1;
     memcpy_P(b->data, handshake_magic, sizeof(handshake_magic));
@@ -104,12 +208,19 @@ static bool relay_handshake_send(struct mobile_adapter *adapter, unsigned char c
     auth[0] = mobile_config_get_relay_token(adapter, auth + 1);
     if (auth[0]) size += MOBILE_RELAY_TOKEN_SIZE;
 
+    return size;
+}
+
+static bool relay_handshake_send(struct mobile_adapter *adapter, unsigned char conn, unsigned size)
+{
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
+
     return mobile_cb_sock_send(adapter, conn, b->data, size, NULL);
 }
 
-static void relay_handshake_recv_debug(struct mobile_adapter *adapter)
+static void relay_handshake_recv_debug(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     debug_prefix(adapter);
     mobile_debug_print(adapter, PSTR("Logged in"));
@@ -128,7 +239,7 @@ static void relay_handshake_recv_debug(struct mobile_adapter *adapter)
 
 static int relay_handshake_recv(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     unsigned recv_size = sizeof(handshake_magic) + 1;
     int recv = relay_recv(adapter, conn, recv_size);
@@ -143,10 +254,14 @@ static int relay_handshake_recv(struct mobile_adapter *adapter, unsigned char co
         return 1;
     } else if (auth[0] == 1) {
         recv_size += MOBILE_RELAY_TOKEN_SIZE;
-        int recv = relay_recv(adapter, conn, recv_size);
+        recv = relay_recv(adapter, conn, recv_size);
         if (recv <= 0) return recv;
 
+        // Only the configured relay may replace the user's token, a token
+        //   issued by a redirect target is only valid for that server
+        if (!relay_link(adapter, conn)->home) return 2;
         mobile_config_set_relay_token_internal(adapter, auth + 1);
+        mobile_relay_number_forget(adapter);
         return 2;
     } else {
         return -1;
@@ -163,7 +278,7 @@ static void relay_call_send_debug(struct mobile_adapter *adapter, const char *nu
 
 static bool relay_call_send(struct mobile_adapter *adapter, unsigned char conn, const char *number, unsigned number_len)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     if (number_len > MOBILE_RELAY_MAX_NUMBER_SIZE) return false;
     unsigned size = 3 + number_len;
@@ -175,9 +290,9 @@ static bool relay_call_send(struct mobile_adapter *adapter, unsigned char conn,
     return mobile_cb_sock_send(adapter, conn, b->data, size, NULL);
 }
 
-static void relay_call_recv_debug(struct mobile_adapter *adapter)
+static void relay_call_recv_debug(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     debug_prefix(adapter);
     switch (b->data[2] + 1) {
@@ -193,21 +308,55 @@ static void relay_call_recv_debug(struct mobile_adapter *adapter)
     case MOBILE_RELAY_CALL_RESULT_UNAVAILABLE:
         mobile_debug_print(adapter, PSTR("Error: UNAVAILABLE"));
         break;
+    case MOBILE_RELAY_CALL_RESULT_REDIRECT:
+        mobile_debug_print(adapter, PSTR("REDIRECT"));
+        break;
     }
     mobile_debug_endl(adapter);
 }
 
-static int relay_call_recv(struct mobile_adapter *adapter, unsigned char conn)
+static int relay_call_recv(struct mobile_adapter *adapter, unsigned char conn, struct mobile_addr *server)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
-    int recv = relay_recv(adapter, conn, 3);
+    unsigned recv_size = 3;
+    int recv = relay_recv(adapter, conn, recv_size);
     if (recv <= 0) return recv;
 
     if (b->data[0] != PROTOCOL_VERSION) return -1;
     if (b->data[1] != MOBILE_RELAY_COMMAND_CALL) return -1;
     int result = b->data[2] + 1;
     if (result >= MOBILE_RELAY_MAX_CALL_RESULT) return -1;
+    if (result != MOBILE_RELAY_CALL_RESULT_REDIRECT) return result;
+
+    // Receive the address of the server to redirect to
+    recv_size += 3;
+    recv = relay_recv(adapter, conn, recv_size);
+    if (recv <= 0) return recv;
+
+    unsigned char *addr = b->data + 3;
+    unsigned port = addr[1] << 8 | addr[2];
+    if (addr[0] == MOBILE_ADDRTYPE_IPV4) {
+        recv_size += MOBILE_HOSTLEN_IPV4;
+        recv = relay_recv(adapter, conn, recv_size);
+        if (recv <= 0) return recv;
+
+        struct mobile_addr4 *addr4 = (struct mobile_addr4 *)server;
+        addr4->type = MOBILE_ADDRTYPE_IPV4;
+        addr4->port = port;
+        memcpy(addr4->host, addr + 3, MOBILE_HOSTLEN_IPV4);
+    } else if (addr[0] == MOBILE_ADDRTYPE_IPV6) {
+        recv_size += MOBILE_HOSTLEN_IPV6;
+        recv = relay_recv(adapter, conn, recv_size);
+        if (recv <= 0) return recv;
+
+        struct mobile_addr6 *addr6 = (struct mobile_addr6 *)server;
+        addr6->type = MOBILE_ADDRTYPE_IPV6;
+        addr6->port = port;
+        memcpy(addr6->host, addr + 3, MOBILE_HOSTLEN_IPV6);
+    } else {
+        return -1;
+    }
 
     return result;
 }
@@ -221,7 +370,7 @@ static void relay_wait_send_debug(struct mobile_adapter *adapter)
 
 static bool relay_wait_send(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     unsigned size = 2;
     b->data[0] = PROTOCOL_VERSION;
@@ -230,9 +379,9 @@ static bool relay_wait_send(struct mobile_adapter *adapter, unsigned char conn)
     return mobile_cb_sock_send(adapter, conn, b->data, size, NULL);
 }
 
-static void relay_wait_recv_debug(struct mobile_adapter *adapter)
+static void relay_wait_recv_debug(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     debug_prefix(adapter);
     switch (b->data[2] + 1) {
@@ -249,7 +398,7 @@ static void relay_wait_recv_debug(struct mobile_adapter *adapter)
 
 static int relay_wait_recv(struct mobile_adapter *adapter, unsigned char conn, char *number, unsigned *number_len)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     unsigned recv_size = 4;
     int recv = relay_recv(adapter, conn, recv_size);
@@ -283,7 +432,7 @@ static void relay_get_number_send_debug(struct mobile_adapter *adapter)
 
 static bool relay_get_number_send(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     unsigned size = 2;
     b->data[0] = PROTOCOL_VERSION;
@@ -292,9 +441,9 @@ static bool relay_get_number_send(struct mobile_adapter *adapter, unsigned char
     return mobile_cb_sock_send(adapter, conn, b->data, size, NULL);
 }
 
-static void relay_get_number_recv_debug(struct mobile_adapter *adapter)
+static void relay_get_number_recv_debug(struct mobile_adapter *adapter, unsigned char conn)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     debug_prefix(adapter);
     mobile_debug_print(adapter, PSTR("Number: "));
@@ -304,7 +453,7 @@ static void relay_get_number_recv_debug(struct mobile_adapter *adapter)
 
 static int relay_get_number_recv(struct mobile_adapter *adapter, unsigned char conn, char *number, unsigned *number_len)
 {
-    struct mobile_buffer_relay *b = &adapter->buffer.relay;
+    struct mobile_buffer_relay *b = relay_buffer(adapter, conn);
 
     unsigned recv_size = 3;
     int recv = relay_recv(adapter, conn, recv_size);
@@ -338,8 +487,9 @@ static int relay_get_number_recv(struct mobile_adapter *adapter, unsigned char c
 // Returns: -1 on error, 0 if processing, 1 on success/already connected
 int mobile_relay_connect(struct mobile_adapter *adapter, unsigned char conn, const struct mobile_addr *server)
 {
-    struct mobile_adapter_relay *s = &adapter->relay;
+    struct mobile_relay_link *s = relay_link(adapter, conn);
 
+    unsigned size;
     int rc;
 
     switch (s->state) {
@@ -348,11 +498,15 @@ int mobile_relay_connect(struct mobile_adapter *adapter, unsigned char conn, con
         mobile_debug_print(adapter, PSTR("Connecting to "));
         mobile_debug_print_addr(adapter, server);
         mobile_debug_endl(adapter);
+        s->home = mobile_addr_compare(server, &adapter->config.relay);
         s->state = MOBILE_RELAY_RECV_CONNECT;
         // fallthrough
 
     case MOBILE_RELAY_RECV_CONNECT:
-        rc = mobile_cb_sock_connect(adapter, conn, server);
+        // Send the handshake along with the connection request, if possible
+        size = relay_handshake_build(adapter, conn);
+        rc = mobile_sock_connect_data(adapter, conn, server,
+            relay_buffer(adapter, conn)->data, size);
         if (rc == 0) return 0;
         if (rc < 0) {
             debug_prefix(adapter);
@@ -363,8 +517,8 @@ int mobile_relay_connect(struct mobile_adapter *adapter, unsigned char conn, con
         }
 
         relay_handshake_send_debug(adapter);
-        if (!relay_handshake_send(adapter, conn)) return -1;
-        relay_recv_reset(adapter);
+        if (rc == 2 && !relay_handshake_send(adapter, conn, size)) return -1;
+        relay_recv_reset(adapter, conn);
         s->state = MOBILE_RELAY_RECV_HANDSHAKE;
         return 0;
 
@@ -378,7 +532,7 @@ int mobile_relay_connect(struct mobile_adapter *adapter, unsigned char conn, con
             s->state = MOBILE_RELAY_DISCONNECTED;
             return -1;
         }
-        relay_handshake_recv_debug(adapter);
+        relay_handshake_recv_debug(adapter, conn);
         s->state = MOBILE_RELAY_CONNECTED;
         return 1;
 
@@ -394,26 +548,31 @@ int mobile_relay_connect(struct mobile_adapter *adapter, unsigned char conn, con
 // call. Once the call is accepted, the adapters are linked, and any further
 // data will be relayed directly to the other adapter.
 //
+// If the number is served by another server, the redirect is remembered, and
+// the connection should be restarted from scratch. See
+// mobile_relay_redirect_get().
+//
 // Parameters:
 // - number: ASCII string containing the number
 // - number_len: Length of the string (max MOBILE_RELAY_MAX_NUMBER_SIZE)
 // Returns: enum mobile_relay_call_result value
 int mobile_relay_call(struct mobile_adapter *adapter, unsigned char conn, const char *number, unsigned number_len)
 {
-    struct mobile_adapter_relay *s = &adapter->relay;
+    struct mobile_relay_link *s = relay_link(adapter, conn);
 
+    struct mobile_addr server;
     int rc;
 
     switch (s->state) {
     case MOBILE_RELAY_CONNECTED:
         relay_call_send_debug(adapter, number, number_len);
         if (!relay_call_send(adapter, conn, number, number_len)) return -1;
-        relay_recv_reset(adapter);
+        relay_recv_reset(adapter, conn);
         s->state = MOBILE_RELAY_RECV_CALL;
         return 0;
 
     case MOBILE_RELAY_RECV_CALL:
-        rc = relay_call_recv(adapter, conn);
+        rc = relay_call_recv(adapter, conn, &server);
         if (rc == 0) return 0;
         if (rc < 0) {
             debug_prefix(adapter);
@@ -423,7 +582,12 @@ int mobile_relay_call(struct mobile_adapter *adapter, unsigned char conn, const
             return -1;
         }
 
-        relay_call_recv_debug(adapter);
+        relay_call_recv_debug(adapter, conn);
+        if (rc == MOBILE_RELAY_CALL_RESULT_REDIRECT) {
+            relay_redirect_set(adapter, number, number_len, &server);
+            s->state = MOBILE_RELAY_DISCONNECTED;
+            return rc;
+        }
         if (rc != MOBILE_RELAY_CALL_RESULT_ACCEPTED) {
             s->state = MOBILE_RELAY_CONNECTED;
             return rc;
@@ -453,7 +617,7 @@ int mobile_relay_call(struct mobile_adapter *adapter, unsigned char conn, const
 // Returns: enum mobile_relay_wait_result value
 int mobile_relay_wait(struct mobile_adapter *adapter, unsigned char conn, char *number, unsigned *number_len)
 {
-    struct mobile_adapter_relay *s = &adapter->relay;
+    struct mobile_relay_link *s = relay_link(adapter, conn);
 
     int rc;
 
@@ -461,7 +625,7 @@ int mobile_relay_wait(struct mobile_adapter *adapter, unsigned char conn, char *
     case MOBILE_RELAY_CONNECTED:
         relay_wait_send_debug(adapter);
         if (!relay_wait_send(adapter, conn)) return -1;
-        relay_recv_reset(adapter);
+        relay_recv_reset(adapter, conn);
         s->state = MOBILE_RELAY_RECV_WAIT;
         return 0;
 
@@ -476,7 +640,7 @@ int mobile_relay_wait(struct mobile_adapter *adapter, unsigned char conn, char *
             return -1;
         }
 
-        relay_wait_recv_debug(adapter);
+        relay_wait_recv_debug(adapter, conn);
         if (rc != MOBILE_RELAY_WAIT_RESULT_ACCEPTED) {
             s->state = MOBILE_RELAY_CONNECTED;
             return rc;
@@ -499,13 +663,15 @@ int mobile_relay_wait(struct mobile_adapter *adapter, unsigned char conn, char *
 //
 // The result buffer must be big enough to contain a full-sized number.
 //
+// The number is remembered until the authentication token changes.
+//
 // Parameters:
 // - number: Buffer to copy the number into
 // - number_len: Pointer to resulting size of the number
 // Returns: -1 on error, 0 if processing, 1 on success
 int mobile_relay_get_number(struct mobile_adapter *adapter, unsigned char conn, char *number, unsigned *number_len)
 {
-    struct mobile_adapter_relay *s = &adapter->relay;
+    struct mobile_relay_link *s = relay_link(adapter, conn);
 
     int rc;
 
@@ -513,7 +679,7 @@ int mobile_relay_get_number(struct mobile_adapter *adapter, unsigned char conn,
     case MOBILE_RELAY_CONNECTED:
         relay_get_number_send_debug(adapter);
         if (!relay_get_number_send(adapter, conn)) return -1;
-        relay_recv_reset(adapter);
+        relay_recv_reset(adapter, conn);
         s->state = MOBILE_RELAY_RECV_GET_NUMBER;
         return 0;
 
@@ -527,7 +693,8 @@ int mobile_relay_get_number(struct mobile_adapter *adapter, unsigned char conn,
             s->state = MOBILE_RELAY_CONNECTED;
             return -1;
         }
-        relay_get_number_recv_debug(adapter);
+        relay_get_number_recv_debug(adapter, conn);
+        relay_number_set(adapter, number, *number_len);
         s->state = MOBILE_RELAY_CONNECTED;
         return 1;
 
@@ -536,6 +703,19 @@ int mobile_relay_get_number(struct mobile_adapter *adapter, unsigned char conn,
     }
 }
 
+// The number assigned to the adapter doesn't change while it keeps using the
+//   same token, so there's no need to ask the server again every time.
+// Returns: true if the number is known
+static bool relay_number_known(struct mobile_adapter *adapter, char *number, unsigned *number_len)
+{
+    struct mobile_buffer_relay_state *s = &adapter->buffer->relay_state;
+
+    if (!s->number_len) return false;
+    memcpy(number, s->number, s->number_len);
+    *number_len = s->number_len;
+    return true;
+}
+
 enum process_call {
     PROCESS_CALL_BEGIN,
     PROCESS_CALL_GET_NUMBER,
@@ -545,7 +725,7 @@ enum process_call {
 // mobile_relay_proc_call - Stateful outgoing call procedure
 int mobile_relay_proc_call(struct mobile_adapter *adapter, unsigned char conn, const struct mobile_addr *server, const char *number, unsigned number_len)
 {
-    struct mobile_adapter_relay *s = &adapter->relay;
+    struct mobile_relay_link *s = relay_link(adapter, conn);
 
     char _number[MOBILE_RELAY_MAX_NUMBER_SIZE + 1];
     unsigned _number_len;
@@ -561,12 +741,19 @@ int mobile_relay_proc_call(struct mobile_adapter *adapter, unsigned char conn, c
         // fallthrough
 
     case PROCESS_CALL_GET_NUMBER:
-        rc = mobile_relay_get_number(adapter, conn, _number, &_number_len);
-        if (rc <= 0) break;
-
-        _number[_number_len] = '\0';
-        mobile_cb_update_number(adapter, MOBILE_NUMBER_USER, _number);
-        adapter->global.number_fetch_retries = 0;
+        // A redirect target would assign a number of its own, which isn't
+        //   the user's. The number has already been reported if it's known.
+        if (s->home) {
+            if (!relay_number_known(adapter, _number, &_number_len)) {
+                rc = mobile_relay_get_number(adapter, conn, _number,
+                    &_number_len);
+                if (rc <= 0) break;
+
+                _number[_number_len] = '\0';
+                mobile_cb_update_number(adapter, MOBILE_NUMBER_USER, _number);
+            }
+            adapter->global.number_fetch_retries = 0;
+        }
 
         s->processing = PROCESS_CALL_CALL;
         // fallthrough
@@ -595,7 +782,7 @@ enum process_wait {
 // mobile_relay_proc_wait - Stateful incoming call procedure
 int mobile_relay_proc_wait(struct mobile_adapter *adapter, unsigned char conn, const struct mobile_addr *server)
 {
-    struct mobile_adapter_relay *s = &adapter->relay;
+    struct mobile_relay_link *s = relay_link(adapter, conn);
 
     char _number[MOBILE_RELAY_MAX_NUMBER_SIZE + 1];
     unsigned _number_len;
@@ -611,11 +798,14 @@ int mobile_relay_proc_wait(struct mobile_adapter *adapter, unsigned char conn, c
         // fallthrough
 
     case PROCESS_WAIT_GET_NUMBER:
-        rc = mobile_relay_get_number(adapter, conn, _number, &_number_len);
-        if (rc <= 0) break;
+        // The number has already been reported if it's known
+        if (!relay_number_known(adapter, _number, &_number_len)) {
+            rc = mobile_relay_get_number(adapter, conn, _number, &_number_len);
+            if (rc <= 0) break;
 
-        _number[_number_len] = '\0';
-        mobile_cb_update_number(adapter, MOBILE_NUMBER_USER, _number);
+            _number[_number_len] = '\0';
+            mobile_cb_update_number(adapter, MOBILE_NUMBER_USER, _number);
+        }
         adapter->global.number_fetch_retries = 0;
 
         s->processing = PROCESS_WAIT_WAIT;
@@ -1,10 +1,13 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 #pragma once
 
-struct mobile_adapter;
-struct mobile_addr;
+#include <stdbool.h>
+
+#include "mobile.h"
 
 #define MOBILE_RELAY_PACKET_SIZE 0x20
+#define MOBILE_RELAY_MAX_NUMBER_SIZE 16
+#define MOBILE_RELAY_MAX_REDIRECTS 4
 
 enum mobile_relay_command {
     MOBILE_RELAY_COMMAND_CALL,
@@ -33,6 +36,7 @@ enum mobile_relay_call_result {
     MOBILE_RELAY_CALL_RESULT_INTERNAL,  // Internal error
     MOBILE_RELAY_CALL_RESULT_BUSY,  // Number is busy
     MOBILE_RELAY_CALL_RESULT_UNAVAILABLE,  // Number not available
+    MOBILE_RELAY_CALL_RESULT_REDIRECT,  // Number served by another server
     MOBILE_RELAY_MAX_CALL_RESULT
 };
 
@@ -49,12 +53,40 @@ struct mobile_buffer_relay {
     unsigned char data[MOBILE_RELAY_PACKET_SIZE];
 };
 
-struct mobile_adapter_relay {
+// Server known to serve a number, as learned from a redirect
+struct mobile_relay_redirect {
+    unsigned char number_len;
+    char number[MOBILE_RELAY_MAX_NUMBER_SIZE];
+    struct mobile_addr server;
+};
+
+// State of a connection to the relay server
+struct mobile_relay_link {
     enum mobile_relay_state state;
     unsigned char processing;
+    bool home;  // Connected to the configured relay, not a redirect target
+};
+
+// Relay state kept in the session buffer, and forgotten along with it
+struct mobile_buffer_relay_state {
+    // Connection used by the calls, and the one used by the number fetch
+    struct mobile_relay_link call;
+    struct mobile_relay_link fetch;
+
+    // Servers learned from redirects
+    struct mobile_relay_redirect redirects[MOBILE_RELAY_MAX_REDIRECTS];
+    unsigned char redirects_next;
+
+    // Number assigned to the current token, once retrieved
+    unsigned char number_len;
+    char number[MOBILE_RELAY_MAX_NUMBER_SIZE];
 };
 
-void mobile_relay_init(struct mobile_adapter *adapter);
+void mobile_relay_init(struct mobile_adapter *adapter, unsigned char conn);
+void mobile_relay_redirect_clear(struct mobile_adapter *adapter);
+void mobile_relay_number_forget(struct mobile_adapter *adapter);
+const struct mobile_addr *mobile_relay_redirect_get(struct mobile_adapter *adapter, const char *number, unsigned number_len);
+void mobile_relay_redirect_forget(struct mobile_adapter *adapter, const char *number, unsigned number_len);
 int mobile_relay_connect(struct mobile_adapter *adapter, unsigned char conn, const struct mobile_addr *server);
 int mobile_relay_call(struct mobile_adapter *adapter, unsigned char conn, const char *number, unsigned number_len);
 int mobile_relay_wait(struct mobile_adapter *adapter, unsigned char conn, char *number, unsigned *number_len);
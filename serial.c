@@ -1,8 +1,17 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 #include "serial.h"
 
+#include <string.h>
+
 #include "mobile_data.h"
 
+#ifdef MOBILE_ENABLE_SUMMARY
+// Only the serial thread writes the counters, so a separate load and store is
+//   enough, and doesn't need a read-modify-write. They wrap around, see
+//   mobile_summary_start().
+#define summary_count(count) ((count) = (uint16_t)((count) + 1))
+#endif
+
 void mobile_serial_init(struct mobile_adapter *adapter)
 {
     adapter->serial.state = MOBILE_SERIAL_INIT;
@@ -10,62 +19,35 @@ void mobile_serial_init(struct mobile_adapter *adapter)
     adapter->serial.active = false;
 }
 
-uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
+// Returns: the device byte sent once the packet being received is complete
+uint8_t mobile_serial_device(const struct mobile_adapter *adapter)
 {
-    struct mobile_adapter_serial *s = &adapter->serial;
-    struct mobile_buffer_serial *b = &adapter->buffer.serial;
-
-    // Workaround for atomic load in clang...
-    enum mobile_serial_state state = s->state;
-
-    switch (state) {
-    case MOBILE_SERIAL_INIT:
-        b->current = 0;
-        s->state = MOBILE_SERIAL_WAITING;
-        // fallthrough
-
-    case MOBILE_SERIAL_WAITING:
-        // Wait for the bytes that indicate a packet will be sent.
-        if (c == 0x99) {
-            b->current = 1;
-        } else if (c == 0x66 && b->current == 1) {
-            // Initialize transfer state
-            b->data_size = 0;
-            b->checksum = 0;
-            b->error = 0;
-
-            b->current = 0;
-            s->state = MOBILE_SERIAL_HEADER;
-        } else {
-            b->current = 0;
-        }
-        break;
+    // The device type is updated with every header outside of a session
+    if (!adapter->commands.session_started) {
+        return (adapter->config.device & ~MOBILE_CONFIG_DEVICE_UNMETERED) |
+            0x80;
+    }
+    return adapter->serial.device | 0x80;
+}
 
-    case MOBILE_SERIAL_HEADER:
-        // Receive the header.
-        b->header[b->current++] = c;
-        b->checksum += c;
+// Receive a packet, see framing.h
+static uint8_t serial_receive(struct mobile_adapter *adapter, uint8_t c)
+{
+    struct mobile_adapter_serial *s = &adapter->serial;
+    struct mobile_buffer_serial *b = &adapter->buffer->serial;
 
-        if (b->current < sizeof(b->header)) break;
+    unsigned char stage = s->state - MOBILE_SERIAL_WAITING;
+    enum mobile_framing_event event = mobile_framing_receive(&b->frame,
+        &stage, s->buffer, s->mode_32bit, c);
+    s->state = MOBILE_SERIAL_WAITING + stage;
 
+    switch (event) {
+    case MOBILE_FRAMING_EVENT_HEADER:
         // Done receiving the header, read content size.
-        b->data_size = b->header[3];
-
-        // Data size is a u16be, but it may not be bigger than 0xff...
-        if (b->header[2] != 0) {
-            b->current = 0;
-            s->state = MOBILE_SERIAL_WAITING;
-        }
+        b->data_size = b->frame.header[3];
+        b->error = 0;
 
         if (!adapter->commands.session_started) {
-            // If we haven't begun a session, this is as good as any place
-            //   to stop parsing, as we shouldn't react to this.
-            // TODO: Re-verify this behavior on hardware.
-            if (b->header[0] != MOBILE_COMMAND_START) {
-                b->current = 0;
-                s->state = MOBILE_SERIAL_WAITING;
-            }
-
             // Update device type
             unsigned char d = adapter->config.device;
             s->device = d & ~MOBILE_CONFIG_DEVICE_UNMETERED;
@@ -73,51 +55,151 @@ uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
         }
 
         // If the command doesn't exist, set the error...
-        if (!mobile_commands_exists(b->header[0])) {
+        if (!mobile_commands_exists(b->frame.header[0])) {
             b->error = MOBILE_SERIAL_ERROR_UNKNOWN_COMMAND;
+#ifdef MOBILE_ENABLE_SUMMARY
+            summary_count(adapter->summary.serial_unknown_commands);
+#endif
+#ifdef MOBILE_ENABLE_METRICS
+            mobile_metrics_add(adapter, serial_unknown_commands, 1);
+#endif
         }
+        break;
 
-        b->current = 0;
-        if (b->data_size) {
-            s->state = MOBILE_SERIAL_DATA;
-        } else {
-            s->state = MOBILE_SERIAL_CHECKSUM;
+    case MOBILE_FRAMING_EVENT_DONE:
+        // Verify the checksum
+        if (b->frame.checksum !=
+                (b->frame.footer[0] << 8 | b->frame.footer[1])) {
+            b->error = MOBILE_SERIAL_ERROR_CHECKSUM;
+#ifdef MOBILE_ENABLE_SUMMARY
+            summary_count(adapter->summary.serial_checksum_errors);
+#endif
+#ifdef MOBILE_ENABLE_METRICS
+            mobile_metrics_add(adapter, serial_checksum_errors, 1);
+#endif
         }
+        s->state = MOBILE_SERIAL_ACKNOWLEDGE;
+        return s->device | 0x80;
+
+    default:
         break;
+    }
 
-    case MOBILE_SERIAL_DATA:
-        // Receive the data
-        s->buffer[b->current++] = c;
-        b->checksum += c;
-        if (b->current >= b->data_size) {
-            if (s->mode_32bit && b->current % 4) {
-                b->current = 4 - (b->current % 4);
-                s->state = MOBILE_SERIAL_DATA_PAD;
+    return MOBILE_SERIAL_IDLE_BYTE;
+}
+
+// Position within the response being sent
+struct serial_response {
+    unsigned char state;
+    unsigned char current;
+    unsigned char data_size;
+};
+
+// Advance the response by one byte. Only the cursor is modified, which allows
+//   predicting the response without touching the adapter's state.
+// Returns the byte to send, or -1 once the acknowledgement footer is complete
+//   and what follows depends on the error that was received.
+static int serial_response_next(const struct mobile_adapter *adapter, struct serial_response *r)
+{
+    const struct mobile_adapter_serial *s = &adapter->serial;
+    const struct mobile_buffer_serial *b = &adapter->buffer->serial;
+    unsigned char c;
+
+    switch (r->state) {
+    case MOBILE_SERIAL_RESPONSE_INIT:
+        r->current = 0;
+        r->state = MOBILE_SERIAL_RESPONSE_START;
+        // fallthrough
+
+    case MOBILE_SERIAL_RESPONSE_START:
+        // Start sending the response.
+        if (r->current++ == 0) return 0x99;
+        r->data_size = b->frame.header[3];
+        r->current = 0;
+        r->state = MOBILE_SERIAL_RESPONSE_HEADER;
+        return 0x66;
+
+    case MOBILE_SERIAL_RESPONSE_HEADER:
+        c = b->frame.header[r->current++];
+        if (r->current >= sizeof(b->frame.header)) {
+            r->current = 0;
+            if (r->data_size) {
+                r->state = MOBILE_SERIAL_RESPONSE_DATA;
             } else {
-                b->current = 0;
-                s->state = MOBILE_SERIAL_CHECKSUM;
+                r->state = MOBILE_SERIAL_RESPONSE_CHECKSUM;
             }
         }
-        break;
+        return c;
 
-    case MOBILE_SERIAL_DATA_PAD:
+    case MOBILE_SERIAL_RESPONSE_DATA:
+        // Send all that's in the response buffer.
+        c = s->buffer[r->current++];
+        if (r->current >= r->data_size) {
+            if (s->mode_32bit && r->current % 4) {
+                r->current = 4 - (r->current % 4);
+                r->state = MOBILE_SERIAL_RESPONSE_DATA_PAD;
+            } else {
+                r->current = 0;
+                r->state = MOBILE_SERIAL_RESPONSE_CHECKSUM;
+            }
+        }
+        return c;
+
+    case MOBILE_SERIAL_RESPONSE_DATA_PAD:
         // In 32bit mode, we must add some extra padding
-        if (!--b->current) s->state = MOBILE_SERIAL_CHECKSUM;
-        break;
+        if (!--r->current) r->state = MOBILE_SERIAL_RESPONSE_CHECKSUM;
+        return 0;
 
-    case MOBILE_SERIAL_CHECKSUM:
-        // Receive the checksum, verify it when done.
-        b->footer[b->current++] = c;
-        if (b->current >= sizeof(b->footer)) {
-            uint16_t in_checksum = b->footer[0] << 8 | b->footer[1];
-            if (b->checksum != in_checksum) {
-                b->error = MOBILE_SERIAL_ERROR_CHECKSUM;
-            }
-            b->current = 0;
-            s->state = MOBILE_SERIAL_ACKNOWLEDGE;
-            return s->device | 0x80;
+    case MOBILE_SERIAL_RESPONSE_CHECKSUM:
+        c = b->frame.footer[r->current++];
+        if (r->current >= sizeof(b->frame.footer)) {
+            r->current = 0;
+            r->state = MOBILE_SERIAL_RESPONSE_ACKNOWLEDGE;
         }
-        break;
+        return c;
+
+    case MOBILE_SERIAL_RESPONSE_ACKNOWLEDGE:
+        // The error byte is received at position 2, the remaining bytes only
+        //   pad the footer in 32bit mode.
+        if (r->current >= (s->mode_32bit ? 4 : 2)) return -1;
+        // There's nothing we can do with the received device ID.
+        // In fact, the real adapter doesn't care for this value, either.
+        return r->current++ == 0 ? s->device | 0x80 : 0;
+    }
+    return -1;
+}
+
+uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
+{
+    struct mobile_adapter_serial *s = &adapter->serial;
+
+#ifdef MOBILE_ENABLE_POOL
+    // Lease the buffers once the game starts sending a packet
+    if (!adapter->buffer) {
+        if (c != 0x99 || !mobile_buffer_lease(adapter)) {
+            return MOBILE_SERIAL_IDLE_BYTE;
+        }
+        s->state = MOBILE_SERIAL_INIT;
+    }
+#endif
+
+    struct mobile_buffer_serial *b = &adapter->buffer->serial;
+
+    // Workaround for atomic load in clang...
+    enum mobile_serial_state state = s->state;
+
+    switch (state) {
+    case MOBILE_SERIAL_INIT:
+        s->state = MOBILE_SERIAL_WAITING;
+        // fallthrough
+
+    case MOBILE_SERIAL_WAITING:
+    case MOBILE_SERIAL_PREAMBLE:
+    case MOBILE_SERIAL_HEADER:
+    case MOBILE_SERIAL_DATA:
+    case MOBILE_SERIAL_DATA_PAD:
+    case MOBILE_SERIAL_CHECKSUM:
+        return serial_receive(adapter, c);
 
     case MOBILE_SERIAL_ACKNOWLEDGE:
         // Receive the acknowledgement byte, send error if applicable.
@@ -133,30 +215,31 @@ uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
             break;
         }
 
-        b->current = 1;
+        b->frame.current = 1;
         s->state = MOBILE_SERIAL_IDLE_CHECK;
-        return b->error ? b->error : b->header[0] ^ 0x80;
+        return b->error ? b->error : b->frame.header[0] ^ 0x80;
 
     case MOBILE_SERIAL_IDLE_CHECK:
         // Skip at least one byte
-        if (b->current--) break;
+        if (b->frame.current--) break;
 
         // If an error was raised or the empty command was sent, reset here.
-        if (b->header[0] == MOBILE_COMMAND_NULL || b->error) {
-            s->state = MOBILE_SERIAL_WAITING;
-            if (c == 0x99) b->current = 1;
+        if (b->frame.header[0] == MOBILE_COMMAND_NULL || b->error) {
+            s->state = c == 0x99 ?
+                MOBILE_SERIAL_PREAMBLE : MOBILE_SERIAL_WAITING;
             break;
         }
 
         // If an idle byte isn't received, reset here.
         if (c != 0x4B) {
-            s->state = MOBILE_SERIAL_WAITING;
-            if (c == 0x99) b->current = 1;
+            s->state = c == 0x99 ?
+                MOBILE_SERIAL_PREAMBLE : MOBILE_SERIAL_WAITING;
             break;
         }
 
         // Otherwise, start processing
         s->state = MOBILE_SERIAL_RESPONSE_WAITING;
+        mobile_group_notify(adapter);
         break;
 
     case MOBILE_SERIAL_RESPONSE_WAITING:
@@ -164,86 +247,46 @@ uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
         break;
 
     case MOBILE_SERIAL_RESPONSE_INIT:
-        b->current = 0;
-        s->state = MOBILE_SERIAL_RESPONSE_START;
-        // fallthrough
-
     case MOBILE_SERIAL_RESPONSE_START:
-        // Start sending the response.
-        if (b->current++ == 0) {
-            return 0x99;
-        } else {
-            b->data_size = b->header[3];
-            b->error = 0;
-            b->current = 0;
-            s->state = MOBILE_SERIAL_RESPONSE_HEADER;
-            return 0x66;
-        }
-
     case MOBILE_SERIAL_RESPONSE_HEADER:
-        c = b->header[b->current++];
-        if (b->current >= sizeof(b->header)) {
-            b->current = 0;
-            if (b->data_size) {
-                s->state = MOBILE_SERIAL_RESPONSE_DATA;
-            } else {
-                s->state = MOBILE_SERIAL_RESPONSE_CHECKSUM;
-            }
-        }
-        return c;
-
     case MOBILE_SERIAL_RESPONSE_DATA:
-        // Send all that's in the response buffer.
-        // This includes the header, content and the checksum.
-        c = s->buffer[b->current++];
-        if (b->current >= b->data_size) {
-            if (s->mode_32bit && b->current % 4) {
-                b->current = 4 - (b->current % 4);
-                s->state = MOBILE_SERIAL_RESPONSE_DATA_PAD;
-            } else {
-                b->current = 0;
-                s->state = MOBILE_SERIAL_RESPONSE_CHECKSUM;
-            }
-        }
-        return c;
-
     case MOBILE_SERIAL_RESPONSE_DATA_PAD:
-        // In 32bit mode, we must add some extra padding
-        if (!--b->current) s->state = MOBILE_SERIAL_RESPONSE_CHECKSUM;
-        return 0;
-
     case MOBILE_SERIAL_RESPONSE_CHECKSUM:
-        c = b->footer[b->current++];
-        if (b->current >= sizeof(b->footer)) {
-            b->current = 0;
-            s->state = MOBILE_SERIAL_RESPONSE_ACKNOWLEDGE;
-        }
-        return c;
-
-    case MOBILE_SERIAL_RESPONSE_ACKNOWLEDGE:
-        if (b->current == 0) {
-            b->current++;
-            return s->device | 0x80;
-        } else if (b->current == 1) {
-            // There's nothing we can do with the received device ID.
-            // In fact, the real adapter doesn't care for this value, either.
-            b->current++;
-            return 0;
-        } else if (b->current == 2) {
-            // Catch the error
+    case MOBILE_SERIAL_RESPONSE_ACKNOWLEDGE: {
+        // Catch the error
+        if (state == MOBILE_SERIAL_RESPONSE_ACKNOWLEDGE &&
+                b->frame.current == 2) {
             b->error = c;
         }
 
-        if (s->mode_32bit && b->current < 4) {
-            b->current++;
-            return 0;
+        struct serial_response r = {
+            .state = state,
+            .current = b->frame.current,
+            .data_size = b->data_size,
+        };
+        int next = serial_response_next(adapter, &r);
+        if (next >= 0) {
+            if (r.state == MOBILE_SERIAL_RESPONSE_HEADER &&
+                    state != MOBILE_SERIAL_RESPONSE_HEADER) {
+                b->error = 0;
+            }
+            b->frame.current = r.current;
+            b->data_size = r.data_size;
+            if (r.state != state) s->state = r.state;
+            return next;
         }
 
-        b->current = 0;
+        b->frame.current = 0;
         // If an error happened, retry.
         if (b->error == MOBILE_SERIAL_ERROR_UNKNOWN_COMMAND ||
                 b->error == MOBILE_SERIAL_ERROR_CHECKSUM ||
                 b->error == MOBILE_SERIAL_ERROR_INTERNAL) {
+#ifdef MOBILE_ENABLE_SUMMARY
+            summary_count(adapter->summary.serial_resends);
+#endif
+#ifdef MOBILE_ENABLE_METRICS
+            mobile_metrics_add(adapter, serial_resends, 1);
+#endif
             s->state = MOBILE_SERIAL_RESPONSE_START;
             break;
         }
@@ -251,6 +294,7 @@ uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
         s->state = MOBILE_SERIAL_WAITING;
         break;
     }
+    }
 
     return MOBILE_SERIAL_IDLE_BYTE;
 }
@@ -258,7 +302,6 @@ uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c)
 uint32_t mobile_serial_transfer_32bit(struct mobile_adapter *adapter, uint32_t c)
 {
     struct mobile_adapter_serial *s = &adapter->serial;
-    struct mobile_buffer_serial *b = &adapter->buffer.serial;
 
     // Unpack the data
     uint8_t d[4] = {c >> 24, c >> 16, c >> 8, c >> 0};
@@ -274,16 +317,113 @@ uint32_t mobile_serial_transfer_32bit(struct mobile_adapter *adapter, uint32_t c
     //   be sent.
     // For this same reason, the received device byte can't be verified either.
     if (s->state == MOBILE_SERIAL_ACKNOWLEDGE) {
+        struct mobile_buffer_serial *b = &adapter->buffer->serial;
+
         d[0] = s->device | 0x80;
-        d[1] = b->error ? b->error : b->header[0] ^ 0x80;
+        d[1] = b->error ? b->error : b->frame.header[0] ^ 0x80;
         d[2] = 0;
         d[3] = 0;
 
         // Ignore the next packet, we can't do anything with it.
-        b->current = 4;
+        b->frame.current = 4;
         s->state = MOBILE_SERIAL_IDLE_CHECK;
     }
 
     // Repack the data
     return d[0] << 24 | d[1] << 16 | d[2] << 8 | d[3] << 0;
 }
+
+static unsigned serial_predict_response(struct mobile_adapter *adapter, unsigned char *data, unsigned size)
+{
+    struct mobile_adapter_serial *s = &adapter->serial;
+    struct mobile_buffer_serial *b = &adapter->buffer->serial;
+
+    // The response only depends on the received data once the error byte has
+    //   been received, walk a copy of the cursor until then.
+    struct serial_response r = {
+        .state = s->state,
+        .current = b->frame.current,
+        .data_size = b->data_size,
+    };
+
+    unsigned count = 0;
+    while (count < size) {
+        int next = serial_response_next(adapter, &r);
+        if (next < 0) {
+            // The last byte of the footer is always the idle byte
+            data[count++] = MOBILE_SERIAL_IDLE_BYTE;
+            break;
+        }
+        data[count++] = next;
+    }
+    return count;
+}
+
+// Predict the data returned by the next calls to mobile_serial_transfer(), as
+//   far as it doesn't depend on the data that will be received.
+// Returns the amount of bytes predicted.
+unsigned mobile_serial_predict(struct mobile_adapter *adapter, unsigned char *data, unsigned size)
+{
+    struct mobile_adapter_serial *s = &adapter->serial;
+
+#ifdef MOBILE_ENABLE_POOL
+    // Without buffers, the serial is waiting for a packet to start
+    if (!adapter->buffer) {
+        unsigned count = size < 7 ? size : 7;
+        memset(data, MOBILE_SERIAL_IDLE_BYTE, count);
+        return count;
+    }
+#endif
+
+    struct mobile_buffer_serial *b = &adapter->buffer->serial;
+
+    // Workaround for atomic load in clang...
+    enum mobile_serial_state state = s->state;
+
+    // While receiving a packet, nothing but idle bytes is sent until the
+    //   checksum has been received, which takes at least this many bytes.
+    unsigned count = 0;
+    switch (state) {
+    case MOBILE_SERIAL_INIT:
+        count = mobile_framing_remaining(&b->frame, MOBILE_FRAMING_WAITING,
+            s->mode_32bit) - 1;
+        break;
+
+    case MOBILE_SERIAL_WAITING:
+    case MOBILE_SERIAL_PREAMBLE:
+    case MOBILE_SERIAL_HEADER:
+        count = mobile_framing_remaining(&b->frame,
+            state - MOBILE_SERIAL_WAITING, s->mode_32bit) - 1;
+        break;
+
+    case MOBILE_SERIAL_DATA:
+    case MOBILE_SERIAL_DATA_PAD:
+    case MOBILE_SERIAL_CHECKSUM:
+        count = mobile_framing_remaining(&b->frame,
+            state - MOBILE_SERIAL_WAITING, s->mode_32bit) - 1;
+
+        // Once the size is known, so is the position of the device byte that
+        //   follows the checksum. In 32bit mode, it shares a word with the
+        //   acknowledgement, which isn't known yet.
+        if (s->mode_32bit || count >= size) break;
+        memset(data, MOBILE_SERIAL_IDLE_BYTE, count);
+        data[count] = mobile_serial_device(adapter);
+        return count + 1;
+
+    case MOBILE_SERIAL_IDLE_CHECK:
+        count = b->frame.current + 1;
+        break;
+
+    case MOBILE_SERIAL_ACKNOWLEDGE:
+    case MOBILE_SERIAL_RESPONSE_WAITING:
+        // Depends on the received data and the processing of the packet
+        break;
+
+    default:
+        return serial_predict_response(adapter, data, size);
+    }
+
+    if (count > size) count = size;
+    memset(data, MOBILE_SERIAL_IDLE_BYTE, count);
+    return count;
+}
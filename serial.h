@@ -6,16 +6,22 @@
 
 #include "mobile.h"
 #include "atomic.h"
+#include "framing.h"
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
 
 #define MOBILE_MAX_DATA_SIZE 0xFF
 
 enum mobile_serial_state {
     MOBILE_SERIAL_INIT,
-    MOBILE_SERIAL_WAITING,
-    MOBILE_SERIAL_HEADER,
-    MOBILE_SERIAL_DATA,
-    MOBILE_SERIAL_DATA_PAD,
-    MOBILE_SERIAL_CHECKSUM,
+
+    // Receiving a packet, one state for every stage in framing.h
+#define X(stage, ...) MOBILE_SERIAL_ ## stage,
+    MOBILE_FRAMING_TABLE(X)
+#undef X
+
     MOBILE_SERIAL_ACKNOWLEDGE,
     MOBILE_SERIAL_IDLE_CHECK,
     MOBILE_SERIAL_RESPONSE_WAITING,
@@ -47,18 +53,19 @@ enum mobile_serial_error {
 
 struct mobile_buffer_serial {
     enum mobile_serial_error error;
-    unsigned char current;
     unsigned char data_size;
-    uint16_t checksum;
-    unsigned char header[4];
-    unsigned char footer[2];
+    struct mobile_framing frame;
 };
 
 struct mobile_adapter_serial {
     _Atomic volatile enum mobile_serial_state state;
     _Atomic volatile bool active;
 
+#ifndef MOBILE_ENABLE_POOL
     unsigned char buffer[MOBILE_MAX_DATA_SIZE];
+#else
+    unsigned char *buffer;
+#endif
 
     bool mode_32bit : 1;
     bool device_unmetered : 1;
@@ -66,7 +73,9 @@ struct mobile_adapter_serial {
 };
 
 void mobile_serial_init(struct mobile_adapter *adapter);
+uint8_t mobile_serial_device(const struct mobile_adapter *adapter);
 uint8_t mobile_serial_transfer(struct mobile_adapter *adapter, uint8_t c);
 uint32_t mobile_serial_transfer_32bit(struct mobile_adapter *adapter, uint32_t c);
+unsigned mobile_serial_predict(struct mobile_adapter *adapter, unsigned char *data, unsigned size);
 
 #undef _Atomic  // "atomic.h"
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "sniffer.h"
+
+#include "commands.h"
+#include "compat.h"
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
+// Passive decoder for a captured link between a console and an adapter.
+//
+// Every byte exchange carries a byte in both directions. Each direction is
+//   decoded separately, with the same framing mobile_serial_transfer() uses,
+//   see framing.h. Every packet is followed by the acknowledgement, during
+//   which the receiving side answers with its device ID and the
+//   acknowledgement/error byte.
+// The serial mode is followed by watching the commands that change it.
+
+static void decoder_init(struct mobile_sniffer_decoder *d)
+{
+    d->state = MOBILE_SNIFFER_WAITING;
+    d->frame.current = 0;
+}
+
+void mobile_sniffer_init(struct mobile_sniffer *sniffer, mobile_func_sniffer_packet func, void *user)
+{
+    sniffer->user = user;
+    sniffer->packet = func;
+    sniffer->mode_32bit = false;
+    sniffer->mode_32bit_request = false;
+    decoder_init(&sniffer->console);
+    decoder_init(&sniffer->adapter);
+}
+
+static void sniffer_packet(struct mobile_sniffer *sniffer, enum mobile_sniffer_source source, uint32_t timestamp)
+{
+    struct mobile_sniffer_decoder *d = source == MOBILE_SNIFFER_CONSOLE ?
+        &sniffer->console : &sniffer->adapter;
+
+    struct mobile_sniffer_packet packet = {
+        .source = source,
+        .command = d->frame.header[0],
+        .length = d->frame.header[3],
+        .data = d->buffer,
+        .checksum_ok = d->frame.checksum ==
+            (d->frame.footer[0] << 8 | d->frame.footer[1]),
+        .device = d->ack[0],
+        .ack = d->ack[1],
+        .time_start = d->time_start,
+        .time_end = timestamp
+    };
+
+    // Follow the serial mode changes, which take effect once the adapter's
+    //   reply has been acknowledged.
+    if (source == MOBILE_SNIFFER_CONSOLE &&
+            packet.command == MOBILE_COMMAND_CHANGE_CLOCK &&
+            packet.length >= 1) {
+        sniffer->mode_32bit_request = packet.data[0] == 1;
+    }
+    if (source == MOBILE_SNIFFER_ADAPTER && packet.checksum_ok &&
+            packet.ack == (packet.command ^ 0x80)) {
+        switch (packet.command ^ 0x80) {
+        case MOBILE_COMMAND_CHANGE_CLOCK:
+            sniffer->mode_32bit = sniffer->mode_32bit_request;
+            break;
+        case MOBILE_COMMAND_END:
+        case MOBILE_COMMAND_REINIT:
+            sniffer->mode_32bit = false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (sniffer->packet) sniffer->packet(sniffer->user, &packet);
+}
+
+// Decode a single byte sent by one side, along with the byte that was sent by
+//   the other side during the same exchange.
+// Returns true when a packet has been completely received.
+static bool decoder_transfer(struct mobile_sniffer_decoder *d, bool mode_32bit, uint8_t c, uint8_t other, uint32_t timestamp)
+{
+    if (d->state != MOBILE_SNIFFER_ACKNOWLEDGE) {
+        unsigned char stage = d->state;
+        enum mobile_framing_event event = mobile_framing_receive(&d->frame,
+            &stage, d->buffer, mode_32bit, c);
+        d->state = stage;
+
+        switch (event) {
+        case MOBILE_FRAMING_EVENT_SYNC:
+            d->time_start = timestamp;
+            break;
+
+        case MOBILE_FRAMING_EVENT_DONE:
+            d->state = MOBILE_SNIFFER_ACKNOWLEDGE;
+            break;
+
+        default:
+            break;
+        }
+        return false;
+    }
+
+    // The receiving side sends its device ID and the acknowledgement.
+    // In 32bit mode, these are followed by two padding bytes.
+    if (d->frame.current < sizeof(d->ack)) d->ack[d->frame.current] = other;
+    d->frame.current++;
+    if (d->frame.current < (mode_32bit ? 4 : 2)) return false;
+
+    d->frame.current = 0;
+    d->state = MOBILE_SNIFFER_WAITING;
+    return true;
+}
+
+void mobile_sniffer_transfer(struct mobile_sniffer *sniffer, uint8_t console, uint8_t adapter, uint32_t timestamp)
+{
+    // The mode may change as a packet is completed, use the same for both
+    bool mode_32bit = sniffer->mode_32bit;
+
+    if (decoder_transfer(&sniffer->console, mode_32bit, console, adapter,
+            timestamp)) {
+        sniffer_packet(sniffer, MOBILE_SNIFFER_CONSOLE, timestamp);
+    }
+    if (decoder_transfer(&sniffer->adapter, mode_32bit, adapter, console,
+            timestamp)) {
+        sniffer_packet(sniffer, MOBILE_SNIFFER_ADAPTER, timestamp);
+    }
+}
+
+void mobile_sniffer_transfer_32bit(struct mobile_sniffer *sniffer, uint32_t console, uint32_t adapter, uint32_t timestamp)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        mobile_sniffer_transfer(sniffer, console >> shift, adapter >> shift,
+            timestamp);
+    }
+}
+
+const size_t mobile_sniffer_sizeof PROGMEM = sizeof(struct mobile_sniffer);
+
+#ifndef MOBILE_ENABLE_NOALLOC
+#include <stdlib.h>
+struct mobile_sniffer *mobile_sniffer_new(mobile_func_sniffer_packet func, void *user)
+{
+    struct mobile_sniffer *sniffer = malloc(sizeof(struct mobile_sniffer));
+    mobile_sniffer_init(sniffer, func, user);
+    return sniffer;
+}
+#endif
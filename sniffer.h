@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mobile.h"
+#include "serial.h"
+#include "framing.h"
+
+enum mobile_sniffer_state {
+    // Receiving a packet, one state for every stage in framing.h
+#define X(stage, ...) MOBILE_SNIFFER_ ## stage,
+    MOBILE_FRAMING_TABLE(X)
+#undef X
+
+    MOBILE_SNIFFER_ACKNOWLEDGE
+};
+
+// Decoding state for a single direction of the link
+struct mobile_sniffer_decoder {
+    enum mobile_sniffer_state state;
+    struct mobile_framing frame;
+    unsigned char ack[2];
+    uint32_t time_start;
+    unsigned char buffer[MOBILE_MAX_DATA_SIZE];
+};
+
+struct mobile_sniffer {
+    void *user;
+    mobile_func_sniffer_packet packet;
+
+    bool mode_32bit : 1;
+    bool mode_32bit_request : 1;
+
+    struct mobile_sniffer_decoder console;
+    struct mobile_sniffer_decoder adapter;
+};
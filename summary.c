@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "summary.h"
+
+#include <string.h>
+
+#include "mobile_data.h"
+
+// Session summaries
+// When MOBILE_ENABLE_SUMMARY is set, a record of every session is kept from
+//   the START command until the session ends, and handed to the
+//   mobile_func_session_summary callback. Everything that's counted is derived
+//   from the packets exchanged with the game, as seen by mobile.c, except for
+//   the serial errors, which are counted by serial.c.
+
+void mobile_summary_init(struct mobile_adapter *adapter)
+{
+#ifdef MOBILE_ENABLE_SUMMARY
+    struct mobile_adapter_summary *s = &adapter->summary;
+
+    memset(&s->record, 0, sizeof(s->record));
+    s->session_start = 0;
+    s->serial_checksum_errors = 0;
+    s->serial_unknown_commands = 0;
+    s->serial_resends = 0;
+    s->serial_checksum_errors_start = 0;
+    s->serial_unknown_commands_start = 0;
+    s->serial_resends_start = 0;
+#else
+    (void)adapter;
+#endif
+}
+
+#ifdef MOBILE_ENABLE_SUMMARY
+static void count_add(uint16_t *count)
+{
+    if (*count < UINT16_MAX) (*count)++;
+}
+
+void mobile_summary_start(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_summary *s = &adapter->summary;
+
+    memset(&s->record, 0, sizeof(s->record));
+    s->session_start = mobile_time_now(adapter);
+
+    // The serial thread keeps counting, only take note of where it's at
+    s->serial_checksum_errors_start = s->serial_checksum_errors;
+    s->serial_unknown_commands_start = s->serial_unknown_commands;
+    s->serial_resends_start = s->serial_resends;
+}
+
+void mobile_summary_end(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_summary *s = &adapter->summary;
+    struct mobile_session_summary *r = &s->record;
+
+    r->duration_ms = mobile_time_now(adapter) - s->session_start;
+    r->serial_checksum_errors = (uint16_t)(s->serial_checksum_errors -
+        s->serial_checksum_errors_start);
+    r->serial_unknown_commands = (uint16_t)(s->serial_unknown_commands -
+        s->serial_unknown_commands_start);
+    r->serial_resends = (uint16_t)(s->serial_resends -
+        s->serial_resends_start);
+    mobile_cb_session_summary(adapter, r);
+}
+
+void mobile_summary_command(struct mobile_adapter *adapter, const struct mobile_command_record *command)
+{
+    struct mobile_session_summary *r = &adapter->summary.record;
+
+    count_add(&r->latency_command[mobile_latency_bucket(command->ms)]);
+    if (command->command < MOBILE_SUMMARY_MAX_COMMANDS) {
+        count_add(&r->commands[command->command]);
+    }
+
+    if (command->error) {
+        count_add(&r->command_errors);
+        if (command->command == MOBILE_COMMAND_DNS_REQUEST) {
+            count_add(&r->dns_misses);
+        }
+        return;
+    }
+
+    switch (command->command) {
+    case MOBILE_COMMAND_TEL:
+    case MOBILE_COMMAND_TCP_CONNECT:
+        count_add(&r->latency_connect[mobile_latency_bucket(command->ms)]);
+        break;
+
+    case MOBILE_COMMAND_DNS_REQUEST:
+        count_add(&r->dns_hits);
+        break;
+
+    case MOBILE_COMMAND_DATA:
+        if (command->conn >= MOBILE_MAX_CONNECTIONS) break;
+        r->bytes_sent[command->conn] += command->sent;
+        r->bytes_recv[command->conn] += command->recv;
+        break;
+
+    default:
+        break;
+    }
+}
+#endif
+
+unsigned mobile_summary_quantile(const uint16_t *latency, unsigned percent)
+{
+    uint32_t total = 0;
+    for (unsigned i = 0; i < MOBILE_SUMMARY_LATENCY_BUCKETS; i++) {
+        total += latency[i];
+    }
+    if (!total) return 0;
+
+    if (percent > 100) percent = 100;
+    uint32_t rank = (total * percent + 99) / 100;
+    if (!rank) rank = 1;
+
+    uint32_t seen = 0;
+    unsigned bucket = 0;
+    for (; bucket < MOBILE_SUMMARY_LATENCY_BUCKETS - 1; bucket++) {
+        seen += latency[bucket];
+        if (seen >= rank) break;
+    }
+    return (1u << bucket) - 1;
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+
+#include "mobile.h"
+#include "atomic.h"
+
+#ifdef MOBILE_LIBCONF_USE
+#include <mobile_config.h>
+#endif
+
+struct mobile_command_record;
+
+struct mobile_adapter_summary {
+#ifdef MOBILE_ENABLE_SUMMARY
+    struct mobile_session_summary record;
+    uint32_t session_start;
+
+    // Only ever written by the serial thread, never reset
+    _Atomic volatile uint16_t serial_checksum_errors;
+    _Atomic volatile uint16_t serial_unknown_commands;
+    _Atomic volatile uint16_t serial_resends;
+
+    // Value of the serial counters when the session started
+    uint16_t serial_checksum_errors_start;
+    uint16_t serial_unknown_commands_start;
+    uint16_t serial_resends_start;
+#endif
+};
+
+void mobile_summary_init(struct mobile_adapter *adapter);
+
+#ifdef MOBILE_ENABLE_SUMMARY
+void mobile_summary_start(struct mobile_adapter *adapter);
+void mobile_summary_end(struct mobile_adapter *adapter);
+void mobile_summary_command(struct mobile_adapter *adapter, const struct mobile_command_record *command);
+#endif
+
+#undef _Atomic  // "atomic.h"
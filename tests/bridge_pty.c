@@ -0,0 +1,457 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// End-to-end test of the hardware bridge driver
+//
+// The driver talks to a simulated bridge through a pseudo-terminal, the same
+//   way a host talks to a real bridge through a serial port. The bridge speaks
+//   the protocol described in bridge.c, and is clocked by a simulated console,
+//   which sends packets in both serial modes and checks every byte the adapter
+//   answers with, most importantly the acknowledgement of each packet.
+//
+// The bridge flushes a batch every BATCH_SIZE exchanges, and waits for the
+//   host to answer it before continuing, so anything the host sends arrives
+//   exactly one batch late, regardless of the scheduling of the pty.
+
+#define _XOPEN_SOURCE 600
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "bridge.h"
+
+#define BATCH_SIZE 8
+#define EXCHANGE_US 125
+#define RESPONSE_LIMIT 0x4000  // Exchanges the console waits for a response
+
+#define FRAME_SYNC 0x5A
+#define FRAME_RECV 0x01
+#define FRAME_RUN 0x81
+#define FRAME_MODE 0x82
+#define FRAME_ACK 0x83
+
+static int host_fd;
+static int mcu_fd;
+
+static struct mobile_adapter adapter;
+static struct mobile_bridge bridge;
+static unsigned host_written;
+
+// Simulated bridge
+static struct {
+    bool mode_32bit;
+    unsigned char device;
+    unsigned char commands[16];
+
+    unsigned char run[MOBILE_BRIDGE_MAX_PAYLOAD];
+    unsigned run_pos;
+    unsigned run_size;
+
+    // Acknowledgement being clocked out
+    unsigned char ack[4];
+    unsigned ack_pos;
+    unsigned ack_size;
+    unsigned char ack_byte;
+
+    // Packet being received from the console, see framing.h
+    enum mobile_framing_stage stage;
+    unsigned current;
+    unsigned char header[4];
+    unsigned char footer[2];
+    uint16_t checksum;
+
+    uint32_t time;
+    uint32_t batch_time;
+    unsigned char batch[BATCH_SIZE];
+    unsigned batch_size;
+    unsigned consumed;
+} mcu;
+
+static void read_exact(int fd, unsigned char *buf, unsigned size)
+{
+    while (size) {
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        CHECK(poll(&p, 1, 1000) == 1);
+        ssize_t r = read(fd, buf, size);
+        CHECK(r > 0);
+        buf += r;
+        size -= (unsigned)r;
+    }
+}
+
+static void write_all(int fd, const unsigned char *buf, unsigned size)
+{
+    while (size) {
+        ssize_t w = write(fd, buf, size);
+        CHECK(w > 0);
+        buf += w;
+        size -= (unsigned)w;
+    }
+}
+
+static void host_write(void *user, const void *data, unsigned size)
+{
+    (void)user;
+    write_all(host_fd, data, size);
+    host_written += size;
+}
+
+static void mcu_frame(unsigned char type, const unsigned char *data, unsigned size)
+{
+    switch (type) {
+    case FRAME_RUN:
+        CHECK(mcu.run_pos == mcu.run_size);
+        memcpy(mcu.run, data, size);
+        mcu.run_pos = 0;
+        mcu.run_size = size;
+        break;
+
+    case FRAME_MODE:
+        CHECK(size == 1);
+        mcu.mode_32bit = data[0];
+        mcu.run_pos = mcu.run_size = 0;
+        mcu.stage = MOBILE_FRAMING_WAITING;
+        break;
+
+    case FRAME_ACK:
+        CHECK(size == 1 + sizeof(mcu.commands));
+        mcu.device = data[0];
+        memcpy(mcu.commands, data + 1, sizeof(mcu.commands));
+        break;
+
+    default:
+        CHECK(!"unknown frame");
+    }
+}
+
+// Read the frames the host wrote since the last batch
+static void mcu_read(void)
+{
+    unsigned char buf[0x400];
+    CHECK(host_written <= sizeof(buf));
+    read_exact(mcu_fd, buf, host_written);
+
+    for (unsigned pos = 0; pos < host_written;) {
+        CHECK(buf[pos] == FRAME_SYNC);
+        unsigned char type = buf[pos + 1];
+        unsigned char size = buf[pos + 2];
+        unsigned char sum = 0;
+        for (unsigned i = 1; i < 3u + size; i++) sum += buf[pos + i];
+        CHECK(sum == buf[pos + 3 + size]);
+        mcu_frame(type, buf + pos + 3, size);
+        pos += 3 + size + 1;
+    }
+    host_written = 0;
+}
+
+// Send the batch to the host, and let it process the batch
+static void mcu_flush(void)
+{
+    unsigned char frame[3 + 5 + BATCH_SIZE + 1];
+    unsigned size = 5 + mcu.batch_size;
+
+    frame[0] = FRAME_SYNC;
+    frame[1] = FRAME_RECV;
+    frame[2] = size;
+    frame[3] = mcu.batch_time >> 0;
+    frame[4] = mcu.batch_time >> 8;
+    frame[5] = mcu.batch_time >> 16;
+    frame[6] = mcu.batch_time >> 24;
+    frame[7] = mcu.consumed;
+    memcpy(frame + 8, mcu.batch, mcu.batch_size);
+    unsigned char sum = 0;
+    for (unsigned i = 1; i < 3 + size; i++) sum += frame[i];
+    frame[3 + size] = sum;
+    write_all(mcu_fd, frame, 3 + size + 1);
+    mcu.batch_size = 0;
+    mcu.consumed = 0;
+
+    unsigned char buf[sizeof(frame)];
+    read_exact(host_fd, buf, 3 + size + 1);
+    mobile_bridge_recv(&bridge, buf, 3 + size + 1);
+    mobile_loop(&adapter);
+    mobile_bridge_poll(&bridge);
+
+    mcu_read();
+}
+
+static unsigned char mcu_ack_byte(void)
+{
+    if (mcu.checksum != (mcu.footer[0] << 8 | mcu.footer[1])) return 0xF1;
+    unsigned char command = mcu.header[0];
+    if (command >= 0x80) return 0xF0;
+    if (!(mcu.commands[command / 8] & (1 << (command % 8)))) return 0xF0;
+    return command ^ 0x80;
+}
+
+// Follow the packets sent by the console
+static void mcu_follow(unsigned char c)
+{
+    unsigned pad = 0;
+    if (mcu.mode_32bit && mcu.header[3] % 4) pad = 4 - mcu.header[3] % 4;
+
+    switch (mcu.stage) {
+    case MOBILE_FRAMING_WAITING:
+        if (c == 0x99) mcu.stage = MOBILE_FRAMING_PREAMBLE;
+        return;
+
+    case MOBILE_FRAMING_PREAMBLE:
+        if (c == 0x99) return;
+        mcu.stage = MOBILE_FRAMING_WAITING;
+        if (c != 0x66) return;
+        mcu.stage = MOBILE_FRAMING_HEADER;
+        mcu.current = 0;
+        mcu.checksum = 0;
+        return;
+
+    case MOBILE_FRAMING_HEADER:
+        mcu.header[mcu.current++] = c;
+        mcu.checksum += c;
+        if (mcu.current < sizeof(mcu.header)) return;
+        mcu.current = 0;
+        if (mcu.header[3]) {
+            mcu.stage = MOBILE_FRAMING_DATA;
+        } else {
+            mcu.stage = MOBILE_FRAMING_CHECKSUM;
+        }
+        return;
+
+    case MOBILE_FRAMING_DATA:
+        mcu.checksum += c;
+        if (++mcu.current < mcu.header[3]) return;
+        mcu.current = 0;
+        mcu.stage = pad ? MOBILE_FRAMING_DATA_PAD : MOBILE_FRAMING_CHECKSUM;
+        return;
+
+    case MOBILE_FRAMING_DATA_PAD:
+        if (++mcu.current < pad) return;
+        mcu.current = 0;
+        mcu.stage = MOBILE_FRAMING_CHECKSUM;
+        return;
+
+    case MOBILE_FRAMING_CHECKSUM:
+        mcu.footer[mcu.current++] = c;
+        if (mcu.current < sizeof(mcu.footer)) return;
+        mcu.stage = MOBILE_FRAMING_WAITING;
+
+        mcu.ack_byte = mcu_ack_byte();
+        mcu.ack[0] = mcu.device;
+        mcu.ack[1] = mcu.ack_byte;
+        mcu.ack[2] = 0;
+        mcu.ack[3] = 0;
+        mcu.ack_pos = 0;
+        mcu.ack_size = mcu.mode_32bit ? 4 : 2;
+        return;
+
+    default:
+        return;
+    }
+}
+
+// Exchange a byte with the console
+// Returns: the byte clocked out to the console
+static unsigned char exchange(unsigned char c)
+{
+    if (!mcu.batch_size) mcu.batch_time = mcu.time;
+    mcu.time += EXCHANGE_US;
+
+    unsigned char out = MOBILE_SERIAL_IDLE_BYTE;
+    if (mcu.ack_pos < mcu.ack_size) {
+        out = mcu.ack[mcu.ack_pos++];
+
+        // The console's device byte is checked in 8bit mode
+        if (!mcu.mode_32bit && mcu.ack_pos == 1 && mcu.device != 0x88 &&
+                c != 0x81 && c != 0x82) {
+            mcu.ack[1] = MOBILE_SERIAL_IDLE_BYTE;
+        }
+    } else {
+        if (mcu.run_pos < mcu.run_size) {
+            CHECK(mcu.consumed == mcu.batch_size);
+            out = mcu.run[mcu.run_pos++];
+            mcu.consumed++;
+        }
+        mcu_follow(c);
+    }
+
+    mcu.batch[mcu.batch_size++] = c;
+    if (mcu.batch_size >= BATCH_SIZE) mcu_flush();
+    return out;
+}
+
+// Idle until the next batch, so a mode change takes effect on both sides
+static void console_sync(void)
+{
+    do exchange(0x4B); while (mcu.batch_size);
+}
+
+static void console_word(const unsigned char *out, unsigned char *in)
+{
+    for (unsigned i = 0; i < 4; i++) {
+        unsigned char c = exchange(out[i]);
+        if (in) in[i] = c;
+    }
+}
+
+// Send a packet, and receive its acknowledgement
+// Returns: the acknowledgement, or the error sent by the adapter
+static unsigned char console_send(unsigned char command, const unsigned char *data, unsigned size, bool corrupt)
+{
+    bool mode_32bit = mcu.mode_32bit;
+    unsigned checksum = command + size;
+
+    exchange(0x99);
+    exchange(0x66);
+    exchange(command);
+    exchange(0);
+    exchange(0);
+    exchange(size);
+    for (unsigned i = 0; i < size; i++) {
+        exchange(data[i]);
+        checksum += data[i];
+    }
+    if (mode_32bit) for (unsigned i = size; i % 4; i++) exchange(0);
+    if (corrupt) checksum++;
+    exchange(checksum >> 8);
+    exchange(checksum);
+
+    if (mode_32bit) {
+        unsigned char out[4] = {0x82, 0, 0, 0};
+        unsigned char in[4];
+        console_word(out, in);
+        CHECK(in[0] == 0x88);
+        CHECK(in[2] == 0 && in[3] == 0);
+        return in[1];
+    }
+
+    CHECK(exchange(0x81) == 0x88);
+    return exchange(0);
+}
+
+// Wait for the response to a packet, and acknowledge it
+// Returns: the command of the response
+static unsigned char console_recv(unsigned char *data, unsigned *size)
+{
+    bool mode_32bit = mcu.mode_32bit;
+
+    unsigned i;
+    for (i = 0; i < RESPONSE_LIMIT; i++) {
+        if (exchange(0x4B) == 0x99) break;
+    }
+    CHECK(i < RESPONSE_LIMIT);
+    CHECK(exchange(0x4B) == 0x66);
+
+    unsigned char header[4];
+    unsigned checksum = 0;
+    for (i = 0; i < 4; i++) {
+        header[i] = exchange(0x4B);
+        checksum += header[i];
+    }
+    for (i = 0; i < header[3]; i++) {
+        data[i] = exchange(0x4B);
+        checksum += data[i];
+    }
+    if (mode_32bit) for (i = header[3]; i % 4; i++) exchange(0x4B);
+    unsigned footer = exchange(0x4B) << 8;
+    footer |= exchange(0x4B);
+    CHECK((checksum & 0xFFFF) == footer);
+    *size = header[3];
+
+    if (mode_32bit) {
+        unsigned char out[4] = {0x82, header[0] ^ 0x80, 0, 0};
+        console_word(out, NULL);
+    } else {
+        CHECK(exchange(0x81) == 0x88);
+        exchange(header[0] ^ 0x80);
+    }
+    return header[0];
+}
+
+static void console_command(unsigned char command, const unsigned char *data, unsigned size, unsigned char *reply, unsigned *reply_size)
+{
+    CHECK(console_send(command, data, size, false) == (command ^ 0x80));
+    CHECK(console_recv(reply, reply_size) == (command ^ 0x80));
+}
+
+static void pty_open(void)
+{
+    host_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(host_fd >= 0);
+    CHECK(grantpt(host_fd) == 0);
+    CHECK(unlockpt(host_fd) == 0);
+    mcu_fd = open(ptsname(host_fd), O_RDWR | O_NOCTTY);
+    CHECK(mcu_fd >= 0);
+
+    // Pass every byte through untouched
+    struct termios t;
+    CHECK(tcgetattr(mcu_fd, &t) == 0);
+    t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL |
+        IXON);
+    t.c_oflag &= ~OPOST;
+    t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    t.c_cflag &= ~(CSIZE | PARENB);
+    t.c_cflag |= CS8;
+    CHECK(tcsetattr(mcu_fd, TCSANOW, &t) == 0);
+}
+
+int main(void)
+{
+    unsigned char reply[MOBILE_MAX_DATA_SIZE];
+    unsigned reply_size;
+
+    pty_open();
+
+    test_adapter_init(&adapter);
+    mobile_time_set_rate(&adapter, 1000000);
+    mobile_bridge_init(&bridge, &adapter, host_write, NULL);
+    mobile_start(&adapter);
+
+    // The bridge is configured before the console starts clocking
+    mobile_bridge_poll(&bridge);
+    mcu_read();
+    CHECK(mcu.device == 0x88);
+
+    console_command(MOBILE_COMMAND_START,
+        (const unsigned char *)"NINTENDO", 8, reply, &reply_size);
+    CHECK(reply_size == 8);
+    console_command(MOBILE_COMMAND_CHECK_STATUS, NULL, 0, reply, &reply_size);
+    CHECK(reply_size == 3);
+
+    // Rejected packets are acknowledged with an error, and not answered
+    CHECK(console_send(MOBILE_COMMAND_CHECK_STATUS, NULL, 0, true) == 0xF1);
+    console_sync();
+    CHECK(console_send(0x30, NULL, 0, false) == 0xF0);
+    console_sync();
+
+    const unsigned char eeprom[2] = {0, 0x10};
+    console_command(MOBILE_COMMAND_EEPROM_READ, eeprom, 2, reply, &reply_size);
+    CHECK(reply_size == 1 + 0x10);
+
+#ifndef MOBILE_ENABLE_NO32BIT
+    // Switch both sides to 32bit mode
+    const unsigned char clock[1] = {1};
+    console_command(MOBILE_COMMAND_CHANGE_CLOCK, clock, 1, reply,
+        &reply_size);
+    console_sync();
+    console_sync();
+    CHECK(mcu.mode_32bit);
+
+    console_command(MOBILE_COMMAND_CHECK_STATUS, NULL, 0, reply, &reply_size);
+    CHECK(console_send(MOBILE_COMMAND_CHECK_STATUS, NULL, 0, true) == 0xF1);
+    console_sync();
+    console_command(MOBILE_COMMAND_EEPROM_READ, eeprom, 2, reply, &reply_size);
+    CHECK(reply_size == 1 + 0x10);
+#endif
+
+    console_command(MOBILE_COMMAND_END, NULL, 0, reply, &reply_size);
+
+    struct mobile_bridge_stats stats;
+    mobile_bridge_get_stats(&bridge, &stats);
+    CHECK(stats.frames_invalid == 0);
+    CHECK(stats.runs > 0);
+
+    mobile_stop(&adapter);
+    close(mcu_fd);
+    close(host_fd);
+    return 0;
+}
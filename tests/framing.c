@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Test of the packet framing table, see framing.h
+
+#include "test.h"
+
+// Receive a whole packet, checking the events and the bytes left at every step
+static void receive_packet(bool mode_32bit, unsigned char command, unsigned size)
+{
+    struct mobile_framing f = {0};
+    unsigned char stage = MOBILE_FRAMING_WAITING;
+    unsigned char data[MOBILE_MAX_DATA_SIZE];
+
+    unsigned char packet[2 + 4 + MOBILE_MAX_DATA_SIZE + 3 + 2];
+    unsigned packet_size = 0;
+    uint16_t checksum = command + size;
+    packet[packet_size++] = 0x99;
+    packet[packet_size++] = 0x66;
+    packet[packet_size++] = command;
+    packet[packet_size++] = 0;
+    packet[packet_size++] = 0;
+    packet[packet_size++] = size;
+    for (unsigned i = 0; i < size; i++) {
+        // Include the preamble bytes, which are only special before the header
+        unsigned char c = i % 3 ? i : 0x99 + i % 2 * (0x66 - 0x99);
+        packet[packet_size++] = c;
+        checksum += c;
+    }
+    if (mode_32bit) for (unsigned i = size; i % 4; i++) packet[packet_size++] = 0;
+    packet[packet_size++] = checksum >> 8;
+    packet[packet_size++] = checksum;
+    if (mode_32bit) CHECK(packet_size % 4 == 0);
+
+    for (unsigned i = 0; i < packet_size; i++) {
+        // Until the header is known, the packet is assumed to carry no data
+        unsigned remaining = packet_size - i;
+        if (i < 6) remaining = 8 - i;
+        CHECK(mobile_framing_remaining(&f, stage, mode_32bit) == remaining);
+
+        enum mobile_framing_event event =
+            mobile_framing_receive(&f, &stage, data, mode_32bit, packet[i]);
+        if (i == 0) {
+            CHECK(event == MOBILE_FRAMING_EVENT_SYNC);
+        } else if (i == 5) {
+            CHECK(event == MOBILE_FRAMING_EVENT_HEADER);
+        } else if (i == packet_size - 1) {
+            CHECK(event == MOBILE_FRAMING_EVENT_DONE);
+        } else {
+            CHECK(event == MOBILE_FRAMING_EVENT_NONE);
+        }
+    }
+
+    CHECK(stage == MOBILE_FRAMING_WAITING);
+    CHECK(f.header[0] == command);
+    CHECK(f.header[3] == size);
+    CHECK(f.checksum == checksum);
+    CHECK((f.footer[0] << 8 | f.footer[1]) == checksum);
+    CHECK(memcmp(data, packet + 6, size) == 0);
+}
+
+static void test_preamble(void)
+{
+    struct mobile_framing f = {0};
+    unsigned char stage = MOBILE_FRAMING_WAITING;
+    unsigned char data[1];
+
+    // Anything but the preamble is ignored
+    CHECK(mobile_framing_receive(&f, &stage, data, false, 0x66) ==
+        MOBILE_FRAMING_EVENT_NONE);
+    CHECK(stage == MOBILE_FRAMING_WAITING);
+    CHECK(mobile_framing_receive(&f, &stage, data, false, 0x4B) ==
+        MOBILE_FRAMING_EVENT_NONE);
+    CHECK(stage == MOBILE_FRAMING_WAITING);
+
+    // A broken preamble starts over
+    mobile_framing_receive(&f, &stage, data, false, 0x99);
+    CHECK(stage == MOBILE_FRAMING_PREAMBLE);
+    mobile_framing_receive(&f, &stage, data, false, 0x4B);
+    CHECK(stage == MOBILE_FRAMING_WAITING);
+
+    // Repeated sync bytes keep waiting for the second preamble byte
+    CHECK(mobile_framing_receive(&f, &stage, data, false, 0x99) ==
+        MOBILE_FRAMING_EVENT_SYNC);
+    CHECK(mobile_framing_receive(&f, &stage, data, false, 0x99) ==
+        MOBILE_FRAMING_EVENT_SYNC);
+    CHECK(stage == MOBILE_FRAMING_PREAMBLE);
+    mobile_framing_receive(&f, &stage, data, false, 0x66);
+    CHECK(stage == MOBILE_FRAMING_HEADER);
+    CHECK(f.current == 0);
+    CHECK(f.checksum == 0);
+}
+
+int main(void)
+{
+    test_preamble();
+
+    static const unsigned sizes[] = {0, 1, 2, 3, 4, 5, 8, 0x7F, 0xFE, 0xFF};
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        receive_packet(false, MOBILE_COMMAND_DATA, sizes[i]);
+        receive_packet(true, MOBILE_COMMAND_DATA, sizes[i]);
+    }
+    return 0;
+}
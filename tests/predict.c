@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Test of mobile_transfer_predict()
+//
+// Right before every transfer of a session, the data the adapter will send is
+//   predicted, and then compared against what it actually sends.
+
+#include "test.h"
+
+#define MAX_TRANSFERS 0x4000
+#define PREDICT_SIZE 0x20
+
+static struct mobile_adapter adapter;
+static struct test_console console;
+
+// Data sent by the adapter during the session
+static unsigned char sent[MAX_TRANSFERS * 4];
+static unsigned sent_size;
+
+// Data predicted right before every transfer
+static struct {
+    unsigned pos;
+    unsigned size;
+    unsigned char data[PREDICT_SIZE];
+} predictions[MAX_TRANSFERS];
+static unsigned transfers;
+
+// Predictions that included the device byte
+static unsigned device_predicted;
+
+static void predict_check(void)
+{
+    for (unsigned i = 0; i < transfers; i++) {
+        unsigned pos = predictions[i].pos;
+        unsigned size = predictions[i].size;
+        if (pos + size > sent_size) size = sent_size - pos;
+        CHECK(memcmp(predictions[i].data, sent + pos, size) == 0);
+    }
+    transfers = 0;
+    sent_size = 0;
+}
+
+static void predict_transfer(struct test_console *console)
+{
+    unsigned unit = console->mode_32bit ? 4 : 1;
+
+    // Record what the previous transfer returned
+    if (transfers) {
+        memcpy(sent + sent_size, console->next, unit);
+        sent_size += unit;
+    }
+
+    CHECK(transfers < MAX_TRANSFERS);
+    predictions[transfers].pos = sent_size;
+    unsigned size = mobile_transfer_predict(console->adapter,
+        predictions[transfers].data, PREDICT_SIZE);
+    CHECK(size <= PREDICT_SIZE);
+    CHECK(size % unit == 0);
+    predictions[transfers].size = size;
+    if (size && predictions[transfers].data[size - 1] == 0x88) {
+        device_predicted++;
+    }
+    transfers++;
+}
+
+// The device byte is predicted as soon as the size of the packet is known
+static void test_device(void)
+{
+    unsigned char data[PREDICT_SIZE];
+
+    static const unsigned char packet[] = {
+        0x99, 0x66, MOBILE_COMMAND_CHECK_STATUS, 0, 0, 2, 1, 2, 0, 0x1C
+    };
+    for (unsigned i = 0; i < sizeof(packet); i++) {
+        unsigned size = mobile_transfer_predict(&adapter, data, sizeof(data));
+        if (i < 6) {
+            CHECK(size);
+            CHECK(data[size - 1] == MOBILE_SERIAL_IDLE_BYTE);
+        } else {
+            // Exchanges left in the packet, including this one
+            CHECK(size == sizeof(packet) - i);
+            CHECK(data[size - 1] == 0x88);
+        }
+        test_exchange(&console, packet[i]);
+    }
+    CHECK(test_exchange(&console, 0x81) == 0x88);
+    CHECK(test_exchange(&console, 0) == (MOBILE_COMMAND_CHECK_STATUS ^ 0x80));
+
+    unsigned char reply[MOBILE_MAX_DATA_SIZE];
+    unsigned reply_size;
+    CHECK(test_recv(&console, reply, &reply_size) ==
+        (MOBILE_COMMAND_CHECK_STATUS ^ 0x80));
+}
+
+int main(void)
+{
+    unsigned char reply[MOBILE_MAX_DATA_SIZE];
+    unsigned reply_size;
+
+    test_adapter_init(&adapter);
+    test_console_init(&console, &adapter);
+    mobile_start(&adapter);
+
+    CHECK(test_command(&console, MOBILE_COMMAND_START,
+        (const unsigned char *)"NINTENDO", 8, reply, &reply_size) ==
+        (MOBILE_COMMAND_START ^ 0x80));
+    test_device();
+
+    console.transfer = predict_transfer;
+    CHECK(test_command(&console, MOBILE_COMMAND_CHECK_STATUS, NULL, 0,
+        reply, &reply_size) == (MOBILE_COMMAND_CHECK_STATUS ^ 0x80));
+    const unsigned char eeprom[2] = {0, 0x80};
+    CHECK(test_command(&console, MOBILE_COMMAND_EEPROM_READ, eeprom, 2,
+        reply, &reply_size) == (MOBILE_COMMAND_EEPROM_READ ^ 0x80));
+    CHECK(reply_size == 1 + 0x80);
+    test_idle(&console, 100);
+    CHECK(test_send(&console, 0x30, NULL, 0) == 0xF0);
+    for (unsigned i = 0; i < 8; i++) test_exchange(&console, 0x4B);
+    predict_check();
+    CHECK(device_predicted);
+
+#ifndef MOBILE_ENABLE_NO32BIT
+    const unsigned char clock[1] = {1};
+    CHECK(test_command(&console, MOBILE_COMMAND_CHANGE_CLOCK, clock, 1,
+        reply, &reply_size) == (MOBILE_COMMAND_CHANGE_CLOCK ^ 0x80));
+    predict_check();
+    console.transfer = NULL;
+    for (unsigned i = 0; i < 8; i++) test_exchange(&console, 0x4B);
+    console.mode_32bit = true;
+
+    console.transfer = predict_transfer;
+    CHECK(test_command(&console, MOBILE_COMMAND_CHECK_STATUS, NULL, 0,
+        reply, &reply_size) == (MOBILE_COMMAND_CHECK_STATUS ^ 0x80));
+    CHECK(test_command(&console, MOBILE_COMMAND_EEPROM_READ, eeprom, 2,
+        reply, &reply_size) == (MOBILE_COMMAND_EEPROM_READ ^ 0x80));
+    CHECK(reply_size == 1 + 0x80);
+    predict_check();
+#endif
+
+    CHECK(test_command(&console, MOBILE_COMMAND_END, NULL, 0,
+        reply, &reply_size) == (MOBILE_COMMAND_END ^ 0x80));
+    predict_check();
+
+    mobile_stop(&adapter);
+    return 0;
+}
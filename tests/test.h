@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+// Helpers shared by the tests
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mobile_data.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+            __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+// Give the adapter a buffer to lease, when built with MOBILE_ENABLE_POOL
+static inline void test_pool_attach(struct mobile_adapter *adapter)
+{
+#ifdef MOBILE_ENABLE_POOL
+    static struct mobile_pool pool;
+    static _Alignas(max_align_t) unsigned char blocks[0x1000];
+
+    CHECK(mobile_pool_block_sizeof <= sizeof(blocks));
+    mobile_pool_init(&pool, blocks, 1);
+    mobile_pool_attach(adapter, &pool);
+#else
+    (void)adapter;
+#endif
+}
+
+static unsigned char test_config[MOBILE_CONFIG_SIZE];
+
+static inline bool test_config_read(void *user, void *dest, uintptr_t offset, size_t size)
+{
+    (void)user;
+    memcpy(dest, test_config + offset, size);
+    return true;
+}
+
+static inline bool test_config_write(void *user, const void *src, uintptr_t offset, size_t size)
+{
+    (void)user;
+    memcpy(test_config + offset, src, size);
+    return true;
+}
+
+// Initialize an adapter with an empty configuration kept in memory
+static inline void test_adapter_init(struct mobile_adapter *adapter)
+{
+    mobile_init(adapter, NULL);
+    mobile_def_config_read(adapter, test_config_read);
+    mobile_def_config_write(adapter, test_config_write);
+    test_pool_attach(adapter);
+}
+
+// Simulated console
+//
+// The console exchanges a byte with the adapter every millisecond of virtual
+//   time, calling mobile_loop() after every exchange, so the adapter's
+//   timebase must be set to TEST_CLOCK_RATE. In 32bit mode, the bytes are
+//   passed to the adapter in whole words.
+
+#define TEST_CLOCK_RATE 1000
+#define TEST_REPLY_LIMIT 0x10000  // Longest the console waits for a reply
+
+struct test_console {
+    struct mobile_adapter *adapter;
+    bool mode_32bit;
+
+    // Virtual time, in milliseconds
+    uint32_t now;
+
+    // Data the adapter sends next, and the word being sent to it
+    unsigned char next[4];
+    unsigned char word[4];
+    unsigned word_size;
+
+    // Called right before every call to the transfer functions, may be NULL
+    void (*transfer)(struct test_console *console);
+};
+
+static inline void test_console_init(struct test_console *console, struct mobile_adapter *adapter)
+{
+    memset(console, 0, sizeof(*console));
+    console->adapter = adapter;
+    memset(console->next, MOBILE_SERIAL_IDLE_BYTE, sizeof(console->next));
+    mobile_time_set_rate(adapter, TEST_CLOCK_RATE);
+}
+
+// Exchange a byte with the adapter, letting a millisecond pass
+// Returns: the byte sent by the adapter during the exchange
+static inline uint8_t test_exchange(struct test_console *console, uint8_t c)
+{
+    struct mobile_adapter *adapter = console->adapter;
+
+    uint8_t other = console->next[console->word_size];
+    console->word[console->word_size++] = c;
+    console->now++;
+
+    if (!console->mode_32bit) {
+        if (console->transfer) console->transfer(console);
+        console->next[0] = mobile_transfer_cycles(adapter, c, 1);
+        console->word_size = 0;
+    } else if (console->word_size == 4) {
+        if (console->transfer) console->transfer(console);
+        uint32_t word = mobile_transfer_32bit_cycles(adapter,
+            (uint32_t)console->word[0] << 24 |
+            (uint32_t)console->word[1] << 16 |
+            (uint32_t)console->word[2] << 8 |
+            (uint32_t)console->word[3] << 0, 4);
+        console->next[0] = word >> 24;
+        console->next[1] = word >> 16;
+        console->next[2] = word >> 8;
+        console->next[3] = word >> 0;
+        console->word_size = 0;
+    }
+
+    mobile_loop(adapter);
+    return other;
+}
+
+static inline void test_idle(struct test_console *console, unsigned ms)
+{
+    while (ms--) {
+        console->now++;
+        mobile_loop_cycles(console->adapter, 1);
+    }
+}
+
+// Send a packet, and receive its acknowledgement
+// Returns: the acknowledgement, or the error sent by the adapter
+static inline uint8_t test_send(struct test_console *console, unsigned char command, const unsigned char *data, unsigned size)
+{
+    uint16_t checksum = command + size;
+    test_exchange(console, 0x99);
+    test_exchange(console, 0x66);
+    test_exchange(console, command);
+    test_exchange(console, 0);
+    test_exchange(console, 0);
+    test_exchange(console, size);
+    for (unsigned i = 0; i < size; i++) {
+        test_exchange(console, data[i]);
+        checksum += data[i];
+    }
+    if (console->mode_32bit) {
+        for (unsigned i = size; i % 4; i++) test_exchange(console, 0);
+    }
+    test_exchange(console, checksum >> 8);
+    test_exchange(console, checksum);
+
+    CHECK(test_exchange(console, 0x81) == 0x88);
+    uint8_t ack = test_exchange(console, 0);
+    if (console->mode_32bit) {
+        test_exchange(console, 0);
+        test_exchange(console, 0);
+    }
+    return ack;
+}
+
+// Wait for the reply to a packet, and acknowledge it
+// Returns: the command of the reply, or -1 if none was received in time
+static inline int test_recv(struct test_console *console, unsigned char *data, unsigned *size)
+{
+    uint32_t i;
+    for (i = 0; i < TEST_REPLY_LIMIT; i++) {
+        if (test_exchange(console, 0x4B) == 0x99) break;
+        if (console->mode_32bit) {
+            for (unsigned j = 1; j < 4; j++) test_exchange(console, 0x4B);
+        }
+    }
+    if (i == TEST_REPLY_LIMIT) return -1;
+    CHECK(test_exchange(console, 0x4B) == 0x66);
+
+    unsigned char header[4];
+    uint16_t checksum = 0;
+    for (i = 0; i < 4; i++) {
+        header[i] = test_exchange(console, 0x4B);
+        checksum += header[i];
+    }
+    for (i = 0; i < header[3]; i++) {
+        data[i] = test_exchange(console, 0x4B);
+        checksum += data[i];
+    }
+    if (console->mode_32bit) {
+        for (i = header[3]; i % 4; i++) test_exchange(console, 0x4B);
+    }
+    uint16_t footer = test_exchange(console, 0x4B) << 8;
+    footer |= test_exchange(console, 0x4B);
+    CHECK(checksum == footer);
+    *size = header[3];
+
+    test_exchange(console, 0x81);
+    test_exchange(console, header[0] ^ 0x80);
+    if (console->mode_32bit) {
+        test_exchange(console, 0);
+        test_exchange(console, 0);
+    }
+    return header[0];
+}
+
+// Send a packet, and wait for its reply
+// Returns: the command of the reply, or -1 if the packet wasn't acknowledged
+//   or no reply was received in time
+static inline int test_command(struct test_console *console, unsigned char command, const unsigned char *data, unsigned size, unsigned char *reply, unsigned *reply_size)
+{
+    if (test_send(console, command, data, size) != (command ^ 0x80)) {
+        return -1;
+    }
+    return test_recv(console, reply, reply_size);
+}
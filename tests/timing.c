@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Test of the round trip time estimate, see mobile_connection_get_stats()
+//
+// A TCP connection is made to a simulated peer, which echoes every send after
+//   a fixed delay of virtual time.
+
+#include "test.h"
+
+#define ECHO_SIZE 0x10
+
+static struct mobile_adapter adapter;
+static struct test_console console;
+
+// Simulated peer
+static struct {
+    uint32_t delay;
+    bool pending;
+    uint32_t due;
+    unsigned size;
+    unsigned char data[MOBILE_MAX_TRANSFER_SIZE];
+} peer;
+
+static bool sock_open(void *user, unsigned conn, enum mobile_socktype type, enum mobile_addrtype addrtype, unsigned bindport)
+{
+    (void)user;
+    (void)conn;
+    (void)addrtype;
+    (void)bindport;
+    CHECK(type == MOBILE_SOCKTYPE_TCP);
+    return true;
+}
+
+static void sock_close(void *user, unsigned conn)
+{
+    (void)user;
+    (void)conn;
+}
+
+static int sock_connect(void *user, unsigned conn, const struct mobile_addr *addr)
+{
+    (void)user;
+    (void)conn;
+    (void)addr;
+    return 1;
+}
+
+static int sock_send(void *user, unsigned conn, const void *data, unsigned size, const struct mobile_addr *addr)
+{
+    (void)user;
+    (void)conn;
+    (void)addr;
+    CHECK(!peer.pending);
+    memcpy(peer.data, data, size);
+    peer.size = size;
+    peer.due = console.now + peer.delay;
+    peer.pending = true;
+    return size;
+}
+
+static int sock_recv(void *user, unsigned conn, void *data, unsigned size, struct mobile_addr *addr)
+{
+    (void)user;
+    (void)conn;
+    (void)addr;
+    if (!peer.pending || (int32_t)(console.now - peer.due) < 0) return 0;
+    CHECK(size >= peer.size);
+    memcpy(data, peer.data, peer.size);
+    peer.pending = false;
+    return peer.size;
+}
+
+// Send data, and poll until it's echoed back
+// Returns: the time it took for the echo to arrive
+static uint32_t echo(unsigned char conn)
+{
+    unsigned char data[1 + ECHO_SIZE];
+    unsigned char reply[MOBILE_MAX_DATA_SIZE];
+    unsigned reply_size;
+
+    data[0] = conn;
+    memset(data + 1, 0x5A, ECHO_SIZE);
+    uint32_t start = console.now;
+    CHECK(test_command(&console, MOBILE_COMMAND_DATA, data, sizeof(data),
+        reply, &reply_size) == (MOBILE_COMMAND_DATA ^ 0x80));
+    while (reply_size <= 1) {
+        CHECK(test_command(&console, MOBILE_COMMAND_DATA, data, 1,
+            reply, &reply_size) == (MOBILE_COMMAND_DATA ^ 0x80));
+    }
+    CHECK(reply_size == sizeof(data));
+    return console.now - start;
+}
+
+// Returns: the time the adapter waits for data when the game sends nothing
+static uint32_t recv_wait(unsigned char conn)
+{
+    unsigned char reply[MOBILE_MAX_DATA_SIZE];
+    unsigned reply_size;
+
+    uint32_t start = console.now;
+    CHECK(test_command(&console, MOBILE_COMMAND_DATA, &conn, 1,
+        reply, &reply_size) == (MOBILE_COMMAND_DATA ^ 0x80));
+    CHECK(reply_size == 1);
+    return console.now - start;
+}
+
+int main(void)
+{
+    unsigned char reply[MOBILE_MAX_DATA_SIZE];
+    unsigned reply_size;
+    struct mobile_connection_stats stats;
+
+    test_adapter_init(&adapter);
+    mobile_def_sock_open(&adapter, sock_open);
+    mobile_def_sock_close(&adapter, sock_close);
+    mobile_def_sock_connect(&adapter, sock_connect);
+    mobile_def_sock_send(&adapter, sock_send);
+    mobile_def_sock_recv(&adapter, sock_recv);
+    test_console_init(&console, &adapter);
+    mobile_start(&adapter);
+
+    CHECK(test_command(&console, MOBILE_COMMAND_START,
+        (const unsigned char *)"NINTENDO", 8, reply, &reply_size) ==
+        (MOBILE_COMMAND_START ^ 0x80));
+    const unsigned char tel[] = {0, '#', '9', '6', '7', '7'};
+    CHECK(test_command(&console, MOBILE_COMMAND_TEL, tel, sizeof(tel),
+        reply, &reply_size) == (MOBILE_COMMAND_TEL ^ 0x80));
+    const unsigned char login[2 + 8] = {0};
+    CHECK(test_command(&console, MOBILE_COMMAND_PPP_CONNECT, login,
+        sizeof(login), reply, &reply_size) ==
+        (MOBILE_COMMAND_PPP_CONNECT ^ 0x80));
+    const unsigned char addr[] = {127, 0, 0, 1, 0, 80};
+    CHECK(test_command(&console, MOBILE_COMMAND_TCP_CONNECT, addr,
+        sizeof(addr), reply, &reply_size) ==
+        (MOBILE_COMMAND_TCP_CONNECT ^ 0x80));
+    CHECK(reply_size == 1);
+    unsigned char conn = reply[0];
+
+    // Nothing is known before the first round trip
+    CHECK(mobile_connection_get_stats(&adapter, conn, &stats));
+    CHECK(stats.rtt_ms == 0);
+    uint32_t wait_default = recv_wait(conn);
+    CHECK(wait_default >= mobile_time_get_timeout(&adapter,
+        MOBILE_TIMEOUT_RECV));
+
+    // The first round trip is taken as is, with half of it as the variation
+    peer.delay = 100;
+    echo(conn);
+    CHECK(mobile_connection_get_stats(&adapter, conn, &stats));
+    CHECK(stats.rtt_ms == 100);
+    CHECK(stats.rtt_var_ms == 50);
+
+    // Further round trips are smoothed, and the variation settles
+    for (unsigned i = 0; i < 3; i++) echo(conn);
+    CHECK(mobile_connection_get_stats(&adapter, conn, &stats));
+    CHECK(stats.rtt_ms == 100);
+    CHECK(stats.rtt_var_ms < 50);
+
+    // A slower peer is followed by an eighth of the difference every time
+    peer.delay = 180;
+    echo(conn);
+    CHECK(mobile_connection_get_stats(&adapter, conn, &stats));
+    CHECK(stats.rtt_ms == 110);
+    for (unsigned i = 0; i < 40; i++) echo(conn);
+    CHECK(mobile_connection_get_stats(&adapter, conn, &stats));
+    CHECK(stats.rtt_ms >= 175 && stats.rtt_ms <= 180);
+    CHECK(stats.bytes_sent == 45 * ECHO_SIZE);
+    CHECK(stats.bytes_recv == 45 * ECHO_SIZE);
+    CHECK(stats.throughput > 0);
+
+    // Once known, the round trip time shortens the wait for incoming data
+    uint32_t wait = recv_wait(conn);
+    CHECK(wait < wait_default);
+    CHECK(wait >= stats.rtt_ms + stats.rtt_var_ms);
+
+    CHECK(test_command(&console, MOBILE_COMMAND_END, NULL, 0,
+        reply, &reply_size) == (MOBILE_COMMAND_END ^ 0x80));
+    CHECK(!mobile_connection_get_stats(&adapter, conn, &stats));
+
+    mobile_stop(&adapter);
+    return 0;
+}
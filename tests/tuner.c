@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+// Test of the trace-replay tuner
+//
+// The recorded session dials a number that never answers, which fails only
+//   once MOBILE_TIMEOUT_CONNECT has passed, so the tuner should shorten it.
+
+#include "test.h"
+#include "tuner.h"
+
+static struct mobile_adapter adapter;
+static struct mobile_tuner tuner;
+
+static bool sock_open(void *user, unsigned conn, enum mobile_socktype type, enum mobile_addrtype addrtype, unsigned bindport)
+{
+    (void)user;
+    (void)conn;
+    (void)type;
+    (void)addrtype;
+    (void)bindport;
+    return true;
+}
+
+static void sock_close(void *user, unsigned conn)
+{
+    (void)user;
+    (void)conn;
+}
+
+static int sock_connect(void *user, unsigned conn, const struct mobile_addr *addr)
+{
+    (void)user;
+    (void)conn;
+    (void)addr;
+    return 0;
+}
+
+static void record(uint32_t time, enum mobile_sniffer_source source, unsigned char command, const void *data, unsigned size)
+{
+    struct mobile_sniffer_packet packet = {
+        .source = source,
+        .command = command,
+        .length = size,
+        .data = data,
+        .checksum_ok = true,
+        .time_start = time,
+        .time_end = time + 10,
+    };
+    mobile_tuner_record(&tuner, &packet);
+}
+
+static void record_command(uint32_t *time, unsigned char command, const void *data, unsigned size)
+{
+    record(*time, MOBILE_SNIFFER_CONSOLE, command, data, size);
+    *time += 20;
+    record(*time, MOBILE_SNIFFER_ADAPTER, command ^ 0x80, "", 0);
+    *time += 20;
+}
+
+int main(void)
+{
+    unsigned defaults[MOBILE_MAX_TIMEOUTS];
+    struct mobile_tuner_result baseline, tuned;
+
+    test_adapter_init(&adapter);
+    mobile_def_sock_open(&adapter, sock_open);
+    mobile_def_sock_close(&adapter, sock_close);
+    mobile_def_sock_connect(&adapter, sock_connect);
+    for (unsigned i = 0; i < MOBILE_MAX_TIMEOUTS; i++) {
+        defaults[i] = mobile_time_get_timeout(&adapter, i);
+    }
+
+    mobile_tuner_init(&tuner, &adapter);
+    CHECK(!mobile_tuner_run(&tuner, &baseline, &tuned));
+
+    uint32_t time = 0;
+    record_command(&time, MOBILE_COMMAND_START, "NINTENDO", 8);
+    record_command(&time, MOBILE_COMMAND_CHECK_STATUS, "", 0);
+    const unsigned char tel[] = "\x00" "127000000001";
+    record_command(&time, MOBILE_COMMAND_TEL, tel, sizeof(tel) - 1);
+    record_command(&time, MOBILE_COMMAND_END, "", 0);
+
+    // A started adapter is started again, with its own table restored
+    mobile_start(&adapter);
+    CHECK(mobile_tuner_run(&tuner, &baseline, &tuned));
+    CHECK(adapter.global.start);
+    CHECK(adapter.time.rate == 0);
+    for (unsigned i = 0; i < MOBILE_MAX_TIMEOUTS; i++) {
+        CHECK(mobile_time_get_timeout(&adapter, i) == defaults[i]);
+        CHECK(baseline.timeouts[i] == defaults[i]);
+    }
+
+    CHECK(baseline.commands == 4);
+    CHECK(baseline.failures == 1);
+    CHECK(baseline.p99_ms >= defaults[MOBILE_TIMEOUT_CONNECT]);
+
+    // The failed call fails sooner, without failing any more commands
+    CHECK(tuned.commands == 4);
+    CHECK(tuned.failures == 1);
+    CHECK(tuned.p99_ms < baseline.p99_ms);
+    CHECK(tuned.timeouts[MOBILE_TIMEOUT_CONNECT] <
+        defaults[MOBILE_TIMEOUT_CONNECT]);
+    CHECK(tuned.p99_ms >= tuned.timeouts[MOBILE_TIMEOUT_CONNECT]);
+
+    // The replay is deterministic, and a stopped adapter is left stopped
+    struct mobile_tuner_result baseline2, tuned2;
+    mobile_stop(&adapter);
+    CHECK(mobile_tuner_run(&tuner, &baseline2, &tuned2));
+    CHECK(!adapter.global.start);
+    CHECK(memcmp(&baseline, &baseline2, sizeof(baseline)) == 0);
+    CHECK(memcmp(&tuned, &tuned2, sizeof(tuned)) == 0);
+
+    return 0;
+}
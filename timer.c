@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "timer.h"
+
+#include <string.h>
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Timekeeping for the library.
+// By default, every timer is implemented by the mobile_func_time_* callbacks.
+//   If a clock rate is configured, the host instead passes the elapsed clock
+//   cycles along with mobile_loop_cycles() and mobile_transfer_cycles(), and
+//   the timers are derived from those.
+
+// Default duration of the timeouts, see enum mobile_timeout
+static const unsigned timeouts_default[MOBILE_MAX_TIMEOUTS] PROGMEM = {
+    [MOBILE_TIMEOUT_SERIAL_IDLE] = 3000,  // Verified on hardware
+    [MOBILE_TIMEOUT_SERIAL_RESYNC] = 500,
+    [MOBILE_TIMEOUT_CONNECT] = 60000,
+    [MOBILE_TIMEOUT_SEND] = 10000,
+    [MOBILE_TIMEOUT_RECV] = 1000,
+    [MOBILE_TIMEOUT_WAIT_CALL] = 1000,
+    [MOBILE_TIMEOUT_DNS] = 3000,
+    [MOBILE_TIMEOUT_NUMBER_FETCH] = 3000,
+    [MOBILE_TIMEOUT_PARKED] = 10000,
+    [MOBILE_TIMEOUT_RELAY_BACKOFF] = 1000,
+    [MOBILE_TIMEOUT_RELAY_STAGGER] = 0,
+};
+
+void mobile_time_init(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    s->rate = 0;
+    s->now = 0;
+    s->remainder = 0;
+    for (unsigned i = 0; i < MOBILE_MAX_TIMERS; i++) s->latch[i] = 0;
+    memcpy_P(s->timeouts, timeouts_default, sizeof(s->timeouts));
+    s->serial_cycles = 0;
+    s->serial_cycles_seen = 0;
+    s->clock_latched = false;
+    s->clock_elapsed = 0;
+    s->clock_step = 1;
+}
+
+void mobile_time_advance(struct mobile_adapter *adapter, uint32_t cycles)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    if (!s->rate) return;
+
+    uint64_t elapsed = (uint64_t)cycles * 1000 + s->remainder;
+    s->now += (uint32_t)(elapsed / s->rate);
+    s->remainder = (uint32_t)(elapsed % s->rate);
+}
+
+// The timer callbacks only allow checking whether a given amount of time has
+//   passed, so the time passed since MOBILE_TIMER_CLOCK was latched is found by
+//   searching for it. The search starts by assuming as much time passed as
+//   between the last two updates, which usually takes one callback if no time
+//   passed at all, or three if mobile_loop() runs at a steady rate. The timer is latched again well before it could exceed the 60
+//   seconds every implementation must be able to track, dropping less than a
+//   millisecond every time.
+#define CLOCK_RELATCH_MS 30000
+#define CLOCK_MAX_MS 60000
+
+static void time_clock_update(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    if (!s->clock_latched) {
+        mobile_cb_time_latch(adapter, MOBILE_TIMER_CLOCK);
+        s->clock_latched = true;
+        s->clock_elapsed = 0;
+        return;
+    }
+
+    uint32_t low = s->clock_elapsed + 1;
+    if (!mobile_cb_time_check_ms(adapter, MOBILE_TIMER_CLOCK, low)) return;
+
+    // Find an upper bound, then narrow it down
+    uint32_t high = s->clock_elapsed + s->clock_step;
+    if (high > CLOCK_MAX_MS) high = CLOCK_MAX_MS;
+    if (high <= low ||
+            mobile_cb_time_check_ms(adapter, MOBILE_TIMER_CLOCK, high)) {
+        if (high > low) low = high;
+        for (uint32_t step = 1;; step *= 2) {
+            high = low + step;
+            if (high > CLOCK_MAX_MS) {
+                high = CLOCK_MAX_MS + 1;
+                break;
+            }
+            if (!mobile_cb_time_check_ms(adapter, MOBILE_TIMER_CLOCK, high)) {
+                break;
+            }
+            low = high;
+        }
+    }
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (mobile_cb_time_check_ms(adapter, MOBILE_TIMER_CLOCK, mid)) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    s->clock_step = low - s->clock_elapsed;
+    s->now += s->clock_step;
+    s->clock_elapsed = low;
+
+    if (s->clock_elapsed >= CLOCK_RELATCH_MS) {
+        mobile_cb_time_latch(adapter, MOBILE_TIMER_CLOCK);
+        s->clock_elapsed = 0;
+    }
+}
+
+// Returns the current time in milliseconds, as of the last mobile_loop()
+uint32_t mobile_time_now(struct mobile_adapter *adapter)
+{
+    return adapter->time.now;
+}
+
+// Collect the cycles counted by the serial thread
+void mobile_time_update(struct mobile_adapter *adapter)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    if (!s->rate) {
+        time_clock_update(adapter);
+        return;
+    }
+
+    uint32_t cycles = s->serial_cycles;
+    mobile_time_advance(adapter, cycles - s->serial_cycles_seen);
+    s->serial_cycles_seen = cycles;
+}
+
+void mobile_time_advance_serial(struct mobile_adapter *adapter, uint32_t cycles)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    // Only the serial thread writes the counter, so a separate load and store
+    //   is enough, and doesn't need a read-modify-write.
+    s->serial_cycles = s->serial_cycles + cycles;
+}
+
+void mobile_time_latch(struct mobile_adapter *adapter, unsigned timer)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    // The latched time is also kept when using the callbacks, for
+    //   mobile_time_remaining()
+    s->latch[timer] = s->now;
+    if (!s->rate) mobile_cb_time_latch(adapter, timer);
+}
+
+bool mobile_time_check_ms(struct mobile_adapter *adapter, unsigned timer, unsigned ms)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    if (!s->rate) return mobile_cb_time_check_ms(adapter, timer, ms);
+    return s->now - s->latch[timer] >= ms;
+}
+
+// Returns: milliseconds left until mobile_time_check_ms() passes, as far as
+//   mobile_time_now() can tell. When using the callbacks, this may be off by a
+//   millisecond, and is only meant for scheduling.
+unsigned mobile_time_remaining(struct mobile_adapter *adapter, unsigned timer, unsigned ms)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    uint32_t elapsed = s->now - s->latch[timer];
+    if (elapsed >= ms) return 0;
+    return ms - elapsed;
+}
+
+bool mobile_time_check_timeout(struct mobile_adapter *adapter, unsigned timer, enum mobile_timeout timeout)
+{
+    return mobile_time_check_ms(adapter, timer,
+        adapter->time.timeouts[timeout]);
+}
+
+void mobile_time_set_timeout(struct mobile_adapter *adapter, enum mobile_timeout timeout, unsigned ms)
+{
+    if (timeout >= MOBILE_MAX_TIMEOUTS) return;
+    adapter->time.timeouts[timeout] = ms;
+}
+
+unsigned mobile_time_get_timeout(struct mobile_adapter *adapter, enum mobile_timeout timeout)
+{
+    if (timeout >= MOBILE_MAX_TIMEOUTS) return 0;
+    return adapter->time.timeouts[timeout];
+}
+
+void mobile_time_set_rate(struct mobile_adapter *adapter, uint32_t rate)
+{
+    struct mobile_adapter_time *s = &adapter->time;
+
+    s->rate = rate;
+    s->remainder = 0;
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mobile.h"
+#include "atomic.h"
+
+struct mobile_adapter_time {
+    // Clock cycles per second of the host-provided timebase
+    // If 0, the mobile_func_time_* callbacks are used instead
+    uint32_t rate;
+
+    // Current time in milliseconds, and leftover cycles (multiplied by 1000)
+    uint32_t now;
+    uint32_t remainder;
+
+    uint32_t latch[MOBILE_MAX_TIMERS];
+
+    // Duration of every timeout, in milliseconds
+    unsigned timeouts[MOBILE_MAX_TIMEOUTS];
+
+    // Time passed since MOBILE_TIMER_CLOCK was latched, if the callbacks are
+    //   used, see time_clock_update()
+    bool clock_latched;
+    uint32_t clock_elapsed;
+    uint32_t clock_step;  // Time found to have passed by the last update
+
+    // Cycles passed through mobile_time_advance_serial()
+    // Only ever written by the serial thread, and read back by mobile_loop()
+    _Atomic volatile uint32_t serial_cycles;
+    uint32_t serial_cycles_seen;
+};
+
+void mobile_time_init(struct mobile_adapter *adapter);
+void mobile_time_advance(struct mobile_adapter *adapter, uint32_t cycles);
+void mobile_time_update(struct mobile_adapter *adapter);
+uint32_t mobile_time_now(struct mobile_adapter *adapter);
+void mobile_time_latch(struct mobile_adapter *adapter, unsigned timer);
+bool mobile_time_check_ms(struct mobile_adapter *adapter, unsigned timer, unsigned ms);
+unsigned mobile_time_remaining(struct mobile_adapter *adapter, unsigned timer, unsigned ms);
+bool mobile_time_check_timeout(struct mobile_adapter *adapter, unsigned timer, enum mobile_timeout timeout);
+
+#undef _Atomic  // "atomic.h"
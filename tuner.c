@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#include "tuner.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include "mobile_data.h"
+#include "compat.h"
+
+// Trace-replay tuner for the timeout table
+//
+// The console's side of a captured session is recorded from the sniffer, as a
+//   list of packets, each preceded by the time the console waited after the
+//   previous reply:
+// - u16be gap: milliseconds between the previous reply and this packet
+// - u8 command
+// - u8 length
+// - u8 data[length]
+//
+// Replaying the trace plays the part of the console: every packet is sent to
+//   the adapter, after which the console polls for the reply and acknowledges
+//   it. The tuner drives the adapter's timebase at one clock cycle per
+//   millisecond, passing a millisecond for every byte exchange, so a session
+//   replays as fast as the library allows. The time between starting to send
+//   a packet and receiving its reply is the command's turnaround.
+//
+// The search is a coordinate descent over the timeout table: every timeout is
+//   tried at a quarter, half and double its value, keeping whichever value
+//   replays with the least failed commands, and then the lowest 99th
+//   percentile turnaround. This is repeated until nothing improves.
+//
+// The adapter is only borrowed during the search. Its timeout table, clock
+//   rate and started state are restored once done, and the tuned table is
+//   only reported through the result.
+
+#define TUNER_CLOCK_RATE 1000
+#define TUNER_REPLY_LIMIT 0x10000  // Longest the console waits for a reply
+#define TUNER_MAX_PASSES 4
+#define TUNER_RECORD_HEADER 4
+
+void mobile_tuner_init(struct mobile_tuner *tuner, struct mobile_adapter *adapter)
+{
+    tuner->adapter = adapter;
+    tuner->trace_size = 0;
+    tuner->commands = 0;
+    tuner->capture_valid = false;
+    tuner->capture_last = 0;
+    tuner->now = 0;
+    tuner->next = MOBILE_SERIAL_IDLE_BYTE;
+    tuner->reply_stage = MOBILE_FRAMING_WAITING;
+    tuner->reply.current = 0;
+}
+
+void mobile_tuner_record(struct mobile_tuner *tuner, const struct mobile_sniffer_packet *packet)
+{
+    if (!packet->checksum_ok) return;
+
+    if (packet->source == MOBILE_SNIFFER_ADAPTER) {
+        tuner->capture_valid = true;
+        tuner->capture_last = packet->time_end;
+        return;
+    }
+
+    // The replay doesn't follow the serial mode, and stays in 8bit mode
+    if (packet->command == MOBILE_COMMAND_CHANGE_CLOCK) return;
+
+    if (tuner->commands >= MOBILE_TUNER_MAX_COMMANDS) return;
+    if (tuner->trace_size + TUNER_RECORD_HEADER + packet->length >
+            MOBILE_TUNER_TRACE_SIZE) {
+        return;
+    }
+
+    uint32_t gap = 0;
+    if (tuner->capture_valid) gap = packet->time_start - tuner->capture_last;
+    if ((int32_t)gap < 0) gap = 0;
+    if (gap > 0xFFFF) gap = 0xFFFF;
+
+    unsigned char *record = tuner->trace + tuner->trace_size;
+    record[0] = gap >> 8;
+    record[1] = gap;
+    record[2] = packet->command;
+    record[3] = packet->length;
+    memcpy(record + TUNER_RECORD_HEADER, packet->data, packet->length);
+    tuner->trace_size += TUNER_RECORD_HEADER + packet->length;
+    tuner->commands++;
+}
+
+// Exchange a byte with the adapter, letting a millisecond pass
+// Returns: the byte sent by the adapter during the exchange
+static uint8_t tuner_exchange(struct mobile_tuner *tuner, uint8_t c)
+{
+    uint8_t other = tuner->next;
+    tuner->next = mobile_transfer_cycles(tuner->adapter, c, 1);
+    tuner->now++;
+    mobile_loop(tuner->adapter);
+    return other;
+}
+
+static void tuner_idle(struct mobile_tuner *tuner, unsigned ms)
+{
+    while (ms--) {
+        tuner->now++;
+        mobile_loop_cycles(tuner->adapter, 1);
+    }
+}
+
+// Send a recorded packet, and wait for its reply
+// Returns: the command of the reply, or -1 if the packet wasn't acknowledged
+//   or no reply was received in time
+static int tuner_command(struct mobile_tuner *tuner, const unsigned char *record)
+{
+    unsigned char command = record[2];
+    unsigned char length = record[3];
+    const unsigned char *data = record + TUNER_RECORD_HEADER;
+
+    uint16_t checksum = command + length;
+    tuner_exchange(tuner, 0x99);
+    tuner_exchange(tuner, 0x66);
+    tuner_exchange(tuner, command);
+    tuner_exchange(tuner, 0);
+    tuner_exchange(tuner, 0);
+    tuner_exchange(tuner, length);
+    for (unsigned i = 0; i < length; i++) {
+        tuner_exchange(tuner, data[i]);
+        checksum += data[i];
+    }
+    tuner_exchange(tuner, checksum >> 8);
+    tuner_exchange(tuner, checksum);
+    tuner_exchange(tuner, 0x81);
+    if (tuner_exchange(tuner, 0) != (command ^ 0x80)) return -1;
+
+    tuner->reply_stage = MOBILE_FRAMING_WAITING;
+    tuner->reply.current = 0;
+    for (uint32_t i = 0; i < TUNER_REPLY_LIMIT; i++) {
+        uint8_t c = tuner_exchange(tuner, 0x4B);
+        enum mobile_framing_event event = mobile_framing_receive(
+            &tuner->reply, &tuner->reply_stage, tuner->reply_data, false, c);
+        if (event != MOBILE_FRAMING_EVENT_DONE) continue;
+
+        unsigned char reply = tuner->reply.header[0];
+        tuner_exchange(tuner, 0x81);
+        tuner_exchange(tuner, reply ^ 0x80);
+        return reply;
+    }
+    return -1;
+}
+
+static uint32_t tuner_percentile(uint32_t *values, unsigned count, unsigned percent)
+{
+    if (!count) return 0;
+
+    // Insertion sort, the amount of commands is small
+    for (unsigned i = 1; i < count; i++) {
+        uint32_t value = values[i];
+        unsigned j = i;
+        for (; j && values[j - 1] > value; j--) values[j] = values[j - 1];
+        values[j] = value;
+    }
+    return values[(count * percent + 99) / 100 - 1];
+}
+
+// Replay the whole trace through a new session
+static void tuner_replay(struct mobile_tuner *tuner, struct mobile_tuner_result *result)
+{
+    struct mobile_adapter *adapter = tuner->adapter;
+
+    mobile_stop(adapter);
+    mobile_start(adapter);
+    tuner->next = MOBILE_SERIAL_IDLE_BYTE;
+
+    result->commands = 0;
+    result->failures = 0;
+    for (unsigned pos = 0; pos < tuner->trace_size;) {
+        const unsigned char *record = tuner->trace + pos;
+        pos += TUNER_RECORD_HEADER + record[3];
+
+        tuner_idle(tuner, record[0] << 8 | record[1]);
+        uint32_t start = tuner->now;
+        int reply = tuner_command(tuner, record);
+        if (reply < 0 || (reply ^ 0x80) == MOBILE_COMMAND_ERROR) {
+            result->failures++;
+        }
+        tuner->turnaround[result->commands++] = tuner->now - start;
+    }
+    result->p99_ms = tuner_percentile(tuner->turnaround, result->commands,
+        99);
+    memcpy(result->timeouts, adapter->time.timeouts,
+        sizeof(result->timeouts));
+
+    mobile_stop(adapter);
+}
+
+static bool tuner_better(const struct mobile_tuner_result *a, const struct mobile_tuner_result *b)
+{
+    if (a->failures != b->failures) return a->failures < b->failures;
+    return a->p99_ms < b->p99_ms;
+}
+
+bool mobile_tuner_run(struct mobile_tuner *tuner, struct mobile_tuner_result *baseline, struct mobile_tuner_result *tuned)
+{
+    struct mobile_adapter *adapter = tuner->adapter;
+    if (!tuner->commands) return false;
+
+    unsigned timeouts[MOBILE_MAX_TIMEOUTS];
+    memcpy(timeouts, adapter->time.timeouts, sizeof(timeouts));
+    uint32_t rate = adapter->time.rate;
+    bool start = adapter->global.start;
+    mobile_time_set_rate(adapter, TUNER_CLOCK_RATE);
+
+    struct mobile_tuner_result best;
+    tuner_replay(tuner, &best);
+    if (baseline) *baseline = best;
+
+    for (unsigned pass = 0; pass < TUNER_MAX_PASSES; pass++) {
+        bool improved = false;
+
+        for (unsigned i = 0; i < MOBILE_MAX_TIMEOUTS; i++) {
+            enum mobile_timeout timeout = i;
+            unsigned value = mobile_time_get_timeout(adapter, timeout);
+            unsigned best_value = value;
+
+            unsigned candidates[] = {
+                value / 4,
+                value / 2,
+                value <= UINT_MAX / 2 ? value * 2 : value
+            };
+            for (unsigned c = 0; c < sizeof(candidates) / sizeof(*candidates);
+                    c++) {
+                if (!candidates[c] || candidates[c] == value) continue;
+
+                struct mobile_tuner_result result;
+                mobile_time_set_timeout(adapter, timeout, candidates[c]);
+                tuner_replay(tuner, &result);
+                if (!tuner_better(&result, &best)) continue;
+
+                best = result;
+                best_value = candidates[c];
+                improved = true;
+            }
+            mobile_time_set_timeout(adapter, timeout, best_value);
+        }
+
+        if (!improved) break;
+    }
+
+    memcpy(adapter->time.timeouts, timeouts, sizeof(timeouts));
+    mobile_time_set_rate(adapter, rate);
+    if (start) mobile_start(adapter);
+
+    if (tuned) *tuned = best;
+    return true;
+}
+
+uint32_t mobile_tuner_time(const struct mobile_tuner *tuner)
+{
+    return tuner->now;
+}
+
+const size_t mobile_tuner_sizeof PROGMEM = sizeof(struct mobile_tuner);
+
+#ifndef MOBILE_ENABLE_NOALLOC
+#include <stdlib.h>
+struct mobile_tuner *mobile_tuner_new(struct mobile_adapter *adapter)
+{
+    struct mobile_tuner *tuner = malloc(sizeof(struct mobile_tuner));
+    mobile_tuner_init(tuner, adapter);
+    return tuner;
+}
+#endif
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mobile.h"
+#include "serial.h"
+#include "framing.h"
+
+// Size of the recorded console packets, including a 4-byte header each
+#define MOBILE_TUNER_TRACE_SIZE 0x1000
+#define MOBILE_TUNER_MAX_COMMANDS 0x100
+
+struct mobile_tuner {
+    struct mobile_adapter *adapter;
+
+    // Console packets of the capture, see tuner.c
+    unsigned trace_size;
+    unsigned commands;
+    unsigned char trace[MOBILE_TUNER_TRACE_SIZE];
+
+    // Timestamp of the last packet sent by the adapter in the capture
+    bool capture_valid : 1;
+    uint32_t capture_last;
+
+    // Virtual time of the replay, in milliseconds
+    uint32_t now;
+
+    // Byte the adapter sends in the next exchange
+    unsigned char next;
+
+    // Reply being received from the adapter
+    unsigned char reply_stage;
+    struct mobile_framing reply;
+    unsigned char reply_data[MOBILE_MAX_DATA_SIZE];
+
+    uint32_t turnaround[MOBILE_TUNER_MAX_COMMANDS];
+};